@@ -1353,6 +1353,9 @@ hasn't been linked.\nPlease define the compilation flag '#define cimg_lapack' be
         return(_temporaryPath);
     }
       
+    // The path is shared by the whole process: it is neither locked
+    // nor freed when replaced.  Set it once, or pass a path of one's
+    // own to CImg::load() and CImg::load_convert() instead.
     inline void set_temporary_path(const char *tempPath) {
         _temporaryPath = strdup(tempPath);
     }
@@ -6183,7 +6186,8 @@ hasn't been linked.\nPlease define the compilation flag '#define cimg_lapack' be
     //------------------------------------------
 
     //! Load the image from a file. The used file format is defined by the file extension in the filename \p filename.
-    static CImg load(const char *filename) {
+    //! Compressed formats are converted in the directory \p temp_path, or in cimg::temporary_path() if it is NULL.
+    static CImg load(const char *filename,const char *temp_path=NULL) {
       const char *ext = cimg::filename_split(filename);
       if (!filename) throw CImgArgumentException("CImg<%s>::load() : Can't load (null) filename",pixel_type());
       if (!cimg::strcasecmp(ext,"inr")) return load_inr(filename);
@@ -6193,7 +6197,7 @@ hasn't been linked.\nPlease define the compilation flag '#define cimg_lapack' be
       if (!cimg::strcasecmp(ext,"pan")) return load_pandore(filename);
       if (!cimg::strcasecmp(ext,"raw") || ext[0]=='\0') return load_raw(filename);
       if (!cimg::strcasecmp(ext,"ppm") || !cimg::strcasecmp(ext,"pgm") || !cimg::strcasecmp(ext,"pnm")) return load_pnm(filename);
-      return load_convert(filename);
+      return load_convert(filename,temp_path);
     }
 
     //! Load the image from an INRIMAGE-4 file.
@@ -6593,11 +6597,17 @@ hasn't been linked.\nPlease define the compilation flag '#define cimg_lapack' be
     //! This is the case for all compressed image formats (GIF,PNG,JPG,TIF,...). You need to install the ImageMagick package in order to get
     //! this function working properly (see http://www.imagemagick.org ).
     // TRB - Loads existing image, converts to PPM, and saves to convert path.  USe MagickWand ConvertImageCommand instead.
-    static CImg load_convert(const char *filename) {
-      srand((unsigned int)::time(NULL));
-      char command[512], filetmp[512];
-      // Build paths
-      std::sprintf(filetmp,"%s/CImg%.4d.ppm",cimg::temporary_path(),::rand()%10000);
+    static CImg load_convert(const char *filename,const char *temp_path=NULL) {
+      char command[512], filetmp[512], filelock[512];
+      if (!temp_path) temp_path = cimg::temporary_path();
+      // Build paths.  The name is reserved with mkstemp(), so that
+      // images loaded concurrently do not share the temporary file.
+      std::sprintf(filelock,"%s/CImgXXXXXX",temp_path);
+      const int fd = mkstemp(filelock);
+      if (fd<0) throw CImgIOException("CImg<%s>::load_convert() : Failed to create a temporary file in '%s'.",
+                                      pixel_type(),temp_path);
+      close(fd);
+      std::sprintf(filetmp,"%s.ppm",filelock);
       std::sprintf(command,"\"%s\" \"%s\" %s",cimg::convert_path(),filename,filetmp);
         
         // Resize image.
@@ -6610,12 +6620,13 @@ hasn't been linked.\nPlease define the compilation flag '#define cimg_lapack' be
         
         // ConvertImageCommand(ImageInfo *, int, char **, char **, MagickExceptionInfo *);
       ConvertImageCommand(imageInfo, 3, (char **)argv, NULL, exceptionInfo);
-  
-        
+      DestroyExceptionInfo(exceptionInfo);
+      DestroyImageInfo(imageInfo);
         
       // LOoks for result by attempting to open it
       std::FILE *file = std::fopen(filetmp,"rb");
       if (!file) {
+        std::remove(filelock);
         std::fclose(cimg::fopen(filename,"r"));
         throw CImgIOException("CImg<%s>::load_convert() : Failed to open image '%s' with 'convert'.\n\
 Check that you have installed the ImageMagick package in a standart directory.",pixel_type(),filename);
@@ -6623,6 +6634,7 @@ Check that you have installed the ImageMagick package in a standart directory.",
       // CImg lib loads the file and then we remove the temp file
       const CImg dest(filetmp);
       std::remove(filetmp);
+      std::remove(filelock);
       return dest;
     }
 
@@ -0,0 +1,57 @@
+#include "test.hh"
+#include "gtimer.h"
+
+/** The number of times each image is transformed. */
+static const int repeats = 5;
+
+/** Time the Hough step, and the steps up to the initial grid, with a
+ * Hough method.  The shortest times of \ref repeats runs are stored.
+ * The growing of the grid is left out: its time depends on how close
+ * the initial grid of the method is.
+ */
+static void
+time_method(const CImg<float> &img, gocam::HoughMethod method,
+	    double &hough, double &total)
+{
+  gocam::Analyser analyser;
+  analyser.verbose = 0;
+  analyser.hough_method = method;
+  for (int r = 0; r < repeats; r++) {
+    double start = gtimer_now();
+    analyser.reset(img);
+    analyser.compute_line_images();
+    analyser.compute_hough_image();
+    analyser.compute_initial_grid();
+    double time = gtimer_now() - start;
+    if (r == 0 || analyser.profile.hough < hough)
+      hough = analyser.profile.hough;
+    if (r == 0 || time < total)
+      total = time;
+  }
+}
+
+/** Compare the dense Hough transform and the kernel-based Hough
+ * transform (KHT) on the sample images.
+ */
+int
+main(int argc, char **argv)
+{
+  double sums[4] = { 0, 0, 0, 0 };
+  std::printf("%-40s %10s %10s %10s %10s\n", "image", "dense", "kht",
+	      "dense grid", "kht grid");
+  for (int i = 1; i < argc; i++) {
+    CImg<float> img;
+    test::load(argv[i], img);
+    double times[4];
+    time_method(img, gocam::HOUGH_DENSE, times[0], times[2]);
+    time_method(img, gocam::HOUGH_KHT, times[1], times[3]);
+    std::printf("%-40s %10.4f %10.4f %10.4f %10.4f\n", argv[i],
+		times[0], times[1], times[2], times[3]);
+    std::fflush(stdout);
+    for (int t = 0; t < 4; t++)
+      sums[t] += times[t];
+  }
+  std::printf("%-40s %10.4f %10.4f %10.4f %10.4f\n", "total",
+	      sums[0], sums[1], sums[2], sums[3]);
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "test.hh"
+#include "gtimer.h"
+#include "../kernel_hough/linking.h"
+#include "../kernel_hough/peak_detection.h"
+#include "../kernel_hough/subdivision.h"
+#include "../kernel_hough/voting.h"
+
+/** The number of times each phase is run. */
+static const int repeats = 5;
+
+/** The number of lines of the limited peak detection, as passed by
+ * the Analyser.
+ */
+static const int max_lines = 60;
+
+/** The phases of kht() timed, in the order of the columns. */
+enum Phase { LINK, VOTE, VOTE_INCREMENTAL, PEAKS, PEAKS_LIMITED,
+	     NUM_PHASES };
+
+/** Keep the shorter of the times of a phase. */
+static void
+keep_best(double *times, int phase, int r, double time)
+{
+  if (r == 0 || time < times[phase])
+    times[phase] = time;
+}
+
+/** Time the phases of kht() with the default parameters on a binary
+ * image.  The shortest times of \ref repeats runs are stored.
+ */
+static void
+time_phases(const CImg<unsigned char> &binary, double *times)
+{
+  kht_context_t context;
+  accumulator_t &accumulator = context.accumulator;
+  lines_list_t lines;
+  for (int r = 0; r < repeats; r++) {
+    CImg<unsigned char> pixels = binary;
+    double start = gtimer_now();
+    find_strings(context.strings, pixels.ptr(), pixels.width,
+		 pixels.height, 10);
+    find_clusters(context.clusters, context.strings, 2.0, 10);
+    keep_best(times, LINK, r, gtimer_now() - start);
+
+    for (int incremental = 1; incremental >= 0; incremental--) {
+      start = gtimer_now();
+      accumulator.init(pixels.width, pixels.height, 0.5);
+      voting(accumulator, context.thread_accumulators, context.threads,
+	     context.kernels, context.used_kernels, context.clusters,
+	     0.002, 2.0, 1, incremental);
+      keep_best(times, incremental ? VOTE_INCREMENTAL : VOTE, r,
+		gtimer_now() - start);
+    }
+
+    start = gtimer_now();
+    peak_detection(lines, context.used_bins, context.visited, accumulator);
+    keep_best(times, PEAKS, r, gtimer_now() - start);
+    start = gtimer_now();
+    peak_detection(lines, context.used_bins, context.convolutions,
+		   accumulator, max_lines, 0.0);
+    keep_best(times, PEAKS_LIMITED, r, gtimer_now() - start);
+  }
+}
+
+/** Time the phases of the kernel-based Hough transform (KHT) on the
+ * feature images of the sample images: linking and clustering the
+ * feature pixels, voting with exact and incremental Gaussians, and
+ * detecting all peaks or the strongest \ref max_lines.
+ */
+int
+main(int argc, char **argv)
+{
+  double sums[NUM_PHASES] = { 0, 0, 0, 0, 0 };
+  std::printf("%-40s %8s %8s %8s %8s %8s\n", "image", "link", "vote",
+	      "vote inc", "peaks", "peaks 60");
+  for (int i = 1; i < argc; i++) {
+    CImg<float> img;
+    CImg<unsigned char> binary;
+    test::load(argv[i], img);
+    test::features(img, binary);
+    double times[NUM_PHASES];
+    time_phases(binary, times);
+    std::printf("%-40s", argv[i]);
+    for (int p = 0; p < NUM_PHASES; p++) {
+      std::printf(" %8.4f", times[p]);
+      sums[p] += times[p];
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+  }
+  std::printf("%-40s", "total");
+  for (int p = 0; p < NUM_PHASES; p++)
+    std::printf(" %8.4f", sums[p]);
+  std::printf("\n");
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include "test.hh"
+#include "gtimer.h"
+
+/** The number of times each image is loaded. */
+static const int repeats = 5;
+
+/** Load an image through the ImageMagick conversion of CImg and
+ * convert it to gray-scale as gocam_analyse() and Analyser::reset()
+ * did.
+ */
+static void
+load_convert(const char *filename, CImg<float> &img)
+{
+  CImg<float>::load_convert(filename, "/tmp").swap(img);
+  img.normalize(0, 1);
+  img.resize(-100, -100, -100, 1);
+  img.normalize(0, 1);
+}
+
+/** Load an image with im::load_gray(). */
+static void
+load_gray(const char *filename, CImg<float> &img)
+{
+  float scale;
+  im::load_gray(filename, img, 0, &scale);
+  img.normalize(0, 1);
+}
+
+/** The shortest time of \ref repeats loads of an image. */
+static double
+time_load(void (*load)(const char*, CImg<float>&), const char *filename,
+	  CImg<float> &img)
+{
+  double best = 0;
+  for (int r = 0; r < repeats; r++) {
+    double start = gtimer_now();
+    load(filename, img);
+    double time = gtimer_now() - start;
+    if (r == 0 || time < best)
+      best = time;
+  }
+  return best;
+}
+
+/** Compare loading the sample images through CImg and ImageMagick to
+ * decoding them directly to gray-scale.  Both must give the same
+ * pixels up to the rounding of normalizing twice.
+ */
+int
+main(int argc, char **argv)
+{
+  double sums[2] = { 0, 0 };
+  std::printf("%-40s %10s %10s\n", "image", "convert", "load_gray");
+  for (int i = 1; i < argc; i++) {
+    CImg<float> converted, gray;
+    double times[2];
+    times[0] = time_load(load_convert, argv[i], converted);
+    times[1] = time_load(load_gray, argv[i], gray);
+    std::printf("%-40s %10.4f %10.4f\n", argv[i], times[0], times[1]);
+    std::fflush(stdout);
+    if (test::check(converted.width == gray.width &&
+		    converted.height == gray.height,
+		    "%s: the sizes differ", argv[i])) {
+      CImgStats stats(converted - gray, false);
+      double diff = util::max(stats.max, -stats.min);
+      test::check(diff <= 1e-6, "%s: the pixels differ by %g", argv[i], diff);
+    }
+    for (int t = 0; t < 2; t++)
+      sums[t] += times[t];
+  }
+  std::printf("%-40s %10.4f %10.4f\n", "total", sums[0], sums[1]);
+  return test::failures > 0;
+}
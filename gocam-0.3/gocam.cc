@@ -9,91 +9,336 @@
 
 namespace gocam {
 
+  Profile::Profile()
+  {
+    clear();
+  }
+
+  void
+  Profile::clear()
+  {
+    total = 0;
+    load = 0;
+    reset = 0;
+    line_images = 0;
+    hough = 0;
+    initial_grid = 0;
+    grow = 0;
+    refine = 0;
+    track = 0;
+    tune_grid = 0;
+    grow_steps.clear();
+    pixels_voted = 0;
+    grow_iterations = 0;
+    tune_grid_calls = 0;
+    tune_line_candidates = 0;
+    peak_memory = 0;
+  }
+
+  void
+  Profile::print(FILE *file) const
+  {
+    fprintf(file, "{\"total\": %f, \"load\": %f, \"reset\": %f, "
+	    "\"line_images\": %f, \"hough\": %f, \"initial_grid\": %f, "
+	    "\"grow\": %f, \"refine\": %f, \"track\": %f, "
+	    "\"tune_grid\": %f, \"grow_steps\": [", total, load, reset, 
+	    line_images, hough, initial_grid, grow, refine, track, tune_grid);
+    for (int i = 0; i < (int)grow_steps.size(); i++)
+      fprintf(file, "%s%f", i > 0 ? ", " : "", grow_steps[i]);
+    fprintf(file, "], \"pixels_voted\": %ld, \"grow_iterations\": %d, "
+	    "\"tune_grid_calls\": %d, \"tune_line_candidates\": %ld, "
+	    "\"peak_memory\": %ld}\n", pixels_voted, grow_iterations, 
+	    tune_grid_calls, tune_line_candidates, peak_memory);
+  }
+
   Analyser::Analyser() 
     : verbose(1),
       board_size(19),
       line_peak_filter_width(5),
       hough_peak_filter_width(5),
+      hough_method(HOUGH_DENSE),
+      kht_threshold(0.15),
+      kht_max_lines(60),
+      kht_incremental_votes(false),
+      hough_threads(1),
+      track_orientation(false),
+      track_theta_margin(3),
+      track_min_confidence(0.7),
+      track_padding(0.15),
+      track_iterations(2),
       line_image_sigma(0.2),
+      tune_exhaustively(false),
+      line_max_run(4),
+      tune_subpixel(false),
+      tune_point_density(2),
+      tune_jacobi(false),
+      tune_jacobi_sweeps(1),
+      tune_threads(1),
+      pyramid_width(0),
+      pyramid_refine_radius(3),
       approx_series_width(10),
       approx_theta_remove_range(25),
       median_peak_remove_width(10),
       num_initial_lines(5),
-      max_initial_lines(10)
+      max_initial_lines(10),
+      orientation_confidence(0),
+      hough_image_windowed(false),
+      line_image_scale(1),
+      image_x(0),
+      image_y(0),
+      tune_radius(0),
+      tracked_strength(0),
+      track_drift(0),
+      track_width(0),
+      track_height(0)
   { 
+    forget_orientation();
   }
 
   void
   Analyser::reset(const CImg<float> &img)
   {
-    image = img;
+    double start = gtimer_now();
+    profile.clear();
 
-    // Convert to gray-scale
-    image.resize(-100, -100, -100, 1);
+    // Convert to gray-scale, unless the image was loaded as
+    // gray-scale already.  Gray-scale images are copied to a pooled
+    // buffer of the same size.
+    if (img.dim == 1 && img.depth == 1) {
+      buffers.images.reuse(image, img.width, img.height);
+      image = img.ptr();
+    }
+    else {
+      image = img;
+      image.resize(-100, -100, -100, 1);
+    }
     image.normalize(0,1);
 
-    // Reset intermediate variables
-    line_image = line_image.empty();
-    weighted_line_image = weighted_line_image.empty();
-    hough_image = hough_image.empty();
-    blurred_hough_image = blurred_hough_image.empty();
+    // Reset intermediate variables.  The line images are overwritten
+    // by compute_line_images(), so their buffers are kept, and the
+    // buffers of the other images are moved to the pool.
+    buffers.images.release(hough_image);
+    buffers.images.release(blurred_hough_image);
     for (int s = 0; s < 2; s++) {
-      max_rho[s] = max_rho[s].empty();
+      buffers.images.release(max_rho[s]);
       initial_lines[s].clear();
       lines[s].clear();
     }
+    hough_image_windowed = false;
+    line_image_scale = 1;
+    image_x = image_y = 0;
+    tune_radius = 0;
+    profile.reset = gtimer_now() - start;
+  }
+
+  void
+  Analyser::forget_orientation()
+  {
+    orientation_tracked = false;
+    tracked_theta[0] = tracked_theta[1] = 0;
+    tracked_confidence = 0;
   }
 
   void
   Analyser::analyse()
   {
-      gtimer_t *line_images = create_gtimer();
-      gtimer_t *hough = create_gtimer();
-      gtimer_t *grid = create_gtimer();
-      gtimer_t *grow = create_gtimer();
-      
-      start_gtimer(line_images);
+    track_width = track_height = 0;
+    line_image_scale = pyramid_factor();
     compute_line_images();
-      stop_gtimer(line_images);
-      
-      start_gtimer(hough);
     compute_hough_image();
-      stop_gtimer(hough);
-      
-      start_gtimer(grid);
     compute_initial_grid();
-      stop_gtimer(grid);
-      
-      start_gtimer(grow);
     grow_grid();
-      stop_gtimer(grow);
-      
-      printf("Analyser::analyse [line_images: %f hough: %f", elapsed_seconds(line_images), elapsed_seconds(hough));
-      printf(" grid: %f grow: %f\n", elapsed_seconds(grid), elapsed_seconds(grow));
+    if (line_image_scale > 1)
+      refine_grid();
+    tracked_strength = 0;
+    if ((int)lines[0].size() == board_size && 
+	(int)lines[1].size() == board_size)
+      tracked_strength = grid_strength();
+    profile.peak_memory = gtimer_peak_memory();
+
     if (verbose > 0)
       fprintf(stderr, "Analysis complete.\n");
   }
 
+  float
+  Analyser::track(const CImg<float> &img)
+  {
+    if ((int)lines[0].size() != board_size || 
+	(int)lines[1].size() != board_size || board_size < 2 ||
+	tracked_strength <= 0)
+      return 0;
+    if (verbose > 0)
+      fprintf(stderr, "Tracking the grid.\n");
+
+    // Map the old grid to the frame, and find the bounding box of
+    // the grid.
+    int scale = line_image_scale;
+    std::vector<geom::Line> *old_lines = buffers.old_lines;
+    float x1 = 1e30, y1 = 1e30, x2 = -1e30, y2 = -1e30;
+    for (int s = 0; s < 2; s++) {
+      old_lines[s].clear();
+      for (int l = 0; l < (int)lines[s].size(); l++) {
+	geom::Line line(image_point(lines[s][l].a), 
+			image_point(lines[s][l].b));
+	old_lines[s].push_back(line);
+	x1 = util::min(x1, util::min(line.a.x, line.b.x));
+	y1 = util::min(y1, util::min(line.a.y, line.b.y));
+	x2 = util::max(x2, util::max(line.a.x, line.b.x));
+	y2 = util::max(y2, util::max(line.a.y, line.b.y));
+      }
+    }
+
+    // The first track() fixes the size of the region, so that the
+    // buffers of the region are reused in the following frames.  A
+    // frame too small for the region is rejected before reset(), so
+    // that the grid is kept for the next frame.
+    double start = gtimer_now();
+    if (track_width == 0) {
+      track_width = (int)((x2 - x1) * (1 + 2 * track_padding)) + 2;
+      track_height = (int)((y2 - y1) * (1 + 2 * track_padding)) + 2;
+    }
+    int width = util::min(track_width, (int)img.width);
+    int height = util::min(track_height, (int)img.height);
+    if (width < 2 * scale || height < 2 * scale)
+      return 0;
+    reset(img);
+
+    // Center the region on the grid inside the frame.  The corner of
+    // the region is kept on the pixel blocks of the pyramid level, so
+    // that the old lines only need to be shifted.
+    int left = (int)((x1 + x2 - width) / 2);
+    int top = (int)((y1 + y2 - height) / 2);
+    left = util::max(util::min(left, (int)image.width - width), 0);
+    top = util::max(util::min(top, (int)image.height - height), 0);
+    left = left / scale * scale;
+    top = top / scale * scale;
+
+    // Copy the region from the frame, and return the buffer of the
+    // frame to the pool for the next reset().
+    CImg<float> frame;
+    frame.swap(image);
+    buffers.images.reuse(image, width, height);
+    for (int y = 0; y < height; y++)
+      std::copy(frame.ptr(left, top + y), frame.ptr(left, top + y) + width,
+		image.ptr(0, y));
+    buffers.images.release(frame);
+    image_x = left;
+    image_y = top;
+    line_image_scale = scale;
+
+    // Tune the old grid in the new line images.
+    float offset = (scale - 1) / 2.0;
+    for (int s = 0; s < 2; s++) {
+      for (int l = 0; l < (int)old_lines[s].size(); l++) {
+	geom::Point a = old_lines[s][l].a;
+	geom::Point b = old_lines[s][l].b;
+	lines[s].push_back(geom::Line(
+	  geom::Point((a.x - left - offset) / scale, 
+		      (a.y - top - offset) / scale),
+	  geom::Point((b.x - left - offset) / scale, 
+		      (b.y - top - offset) / scale)));
+      }
+    }
+    compute_line_images();
+    for (int i = 0; i < track_iterations; i++)
+      tune_grid();
+
+    // The corners are the end points of the outermost lines.
+    track_drift = 0;
+    const int edges[2] = { 0, (int)lines[0].size() - 1 };
+    for (int e = 0; e < 2; e++) {
+      int l = edges[e];
+      geom::Point a = image_point(lines[0][l].a);
+      geom::Point b = image_point(lines[0][l].b);
+      track_drift = util::max(track_drift, util::max(
+	a.get_sub(old_lines[0][l].a).length(),
+	b.get_sub(old_lines[0][l].b).length()));
+    }
+    float strength = grid_strength() / tracked_strength;
+    profile.track = gtimer_now() - start;
+    profile.peak_memory = gtimer_peak_memory();
+
+    if (verbose > 0)
+      fprintf(stderr, "Tracked the grid: strength %f, drift %f.\n", 
+	      strength, track_drift);
+    return strength;
+  }
+
   void
   Analyser::compute_line_images()
   {
     if (verbose > 0)
       fprintf(stderr, "Computing the line images.\n");
+    double start = gtimer_now();
+
+    // Scale the image down for the pyramid.  The buffers of each
+    // level are kept in the pool.
+    const CImg<float> *src = &image;
+    if (line_image_scale > 1) {
+      buffers.images.reuse(scaled_image, image.width / line_image_scale,
+			   image.height / line_image_scale);
+      im::downsample(image, line_image_scale, scaled_image, &buffers.row);
+      src = &scaled_image;
+    }
+    buffers.images.reuse(line_image, src->width, src->height);
+    buffers.images.reuse(weighted_line_image, src->width, src->height);
+    for (int i = 0; i < 2; i++)
+      buffers.images.reuse(line_max_image[i], src->width, src->height);
+
+    // Compute the line image using a peak filter, and weight it with
+    // Gaussian
+    im::peak_filter_gaussian(*src, line_peak_filter_width, -1,
+			     util::sqr(src->width * line_image_sigma),
+			     util::sqr(src->height * line_image_sigma),
+			     line_image, weighted_line_image, 
+			     &buffers.filter);
+    for (int i = 0; i < 2; i++)
+      im::run_max(line_image, line_max_run, i == 0, line_max_image[i]);
+    line_sums.assign(line_image, &buffers.sum_images);
+    profile.line_images += gtimer_now() - start;
+  }
+
+  int
+  Analyser::pyramid_factor() const
+  {
+    int factor = 1;
+    if (pyramid_width > 0)
+      while ((int)image.width / (factor * 2) >= pyramid_width)
+	factor *= 2;
+    return factor;
+  }
+
+  geom::Point
+  Analyser::image_point(const geom::Point &point) const
+  {
+    float offset = (line_image_scale - 1) / 2.0;
+    return geom::Point(point.x * line_image_scale + offset + image_x,
+		       point.y * line_image_scale + offset + image_y);
+  }
+
+  void
+  Analyser::refine_grid()
+  {
+    if (verbose > 0)
+      fprintf(stderr, "Refining the grid at scale 1/%d.\n", 
+	      line_image_scale / 2);
+    double start = gtimer_now();
 
-    // Compute the line image using a peak filter 
-    CImg<float> filter = im::peak_filter<float>(line_peak_filter_width, -1);
-    line_image = image.get_correlate(filter);
-    im::zero_negatives(line_image);
-    line_image.normalize(0, 1);
-
-    // Weight the line image with Gaussian
-    weighted_line_image = line_image;
-    im::weight_gaussian(weighted_line_image, 
-			weighted_line_image.width / 2.0,
-			weighted_line_image.height / 2.0,
-			util::sqr(line_image.width * line_image_sigma),
-			util::sqr(line_image.height * line_image_sigma));
-    weighted_line_image.normalize(0, 1);
+    // The pixel x of a level is centered at 2x + 0.5 on the next
+    // finer level.
+    for (int s = 0; s < 2; s++) {
+      for (int l = 0; l < (int)lines[s].size(); l++) {
+	geom::Line &line = lines[s][l];
+	line = geom::Line(geom::Point(line.a.x * 2 + 0.5, line.a.y * 2 + 0.5),
+			  geom::Point(line.b.x * 2 + 0.5, line.b.y * 2 + 0.5));
+      }
+    }
+    line_image_scale /= 2;
+    compute_line_images();
+    tune_radius = pyramid_refine_radius;
+    tune_grid();
+    tune_radius = 0;
+    profile.refine += gtimer_now() - start;
   }
 
   void
@@ -109,40 +354,165 @@ namespace gocam {
     if (verbose > 0)
       fprintf(stderr, "Computing the hough image.\n");
 
+    double start = gtimer_now();
+    if (hough_method == HOUGH_KHT)
+      compute_kht_hough_image();
+    else if (track_orientation && orientation_tracked)
+      compute_windowed_hough_image();
+    else
+      compute_dense_hough_image();
+    profile.hough += gtimer_now() - start;
+  }
+
+  void
+  Analyser::compute_dense_hough_image()
+  {
     // Compute the hough image for degrees 0, 1, ..., 179.
     int max_rho = cimg::max(weighted_line_image.height,
 			    weighted_line_image.width) / 2;
-    CImg<float> tmp_hough = im::hough(weighted_line_image, 
-				      0, 179, 180, max_rho);
-
-    // Extend the image to degrees 0, 1, ..., 359 by copying the image
-    // upside down to right.
-    hough_image = CImg<float>(tmp_hough.width * 2, tmp_hough.height);
-    im::paste_image(tmp_hough, hough_image, 0, 0);
-    tmp_hough.flip('y');
-    im::paste_image(tmp_hough, hough_image, tmp_hough.width, 0);
-
-    // Amplify peaks with a peak filter, remove negatives, and normalize
-    CImg<float> filter = im::peak_filter<float>(hough_peak_filter_width, 1);
-    hough_image.correlate(filter);
+    int num_pixels = 0;
+    CImg<float> &tmp_hough = buffers.raw_hough;
+    im::hough(weighted_line_image, 0, 179, 180, max_rho, tmp_hough,
+	      buffers.hough, hough_threads, &num_pixels);
+    profile.pixels_voted += num_pixels;
+
+    // Amplify peaks with a peak filter, remove negatives, and
+    // normalize.  Degrees 180, 181, ..., 359 are the same columns
+    // upside down, so the filter wraps around through them, and they
+    // are read through im::HoughView later.
+    buffers.images.reuse(hough_image, tmp_hough.width, tmp_hough.height);
+    im::peak_filter_hough(tmp_hough, hough_peak_filter_width, 1, 
+			  buffers.full_hough, hough_image, &buffers.filter);
+    hough_image_windowed = false;
+  }
+
+  void
+  Analyser::compute_windowed_hough_image()
+  {
+    if (verbose > 1)
+      fprintf(stderr, "Computing the hough image around thetas %d and %d.\n",
+	      tracked_theta[0], tracked_theta[1]);
+
+    int max_rho = cimg::max(weighted_line_image.height,
+			    weighted_line_image.width) / 2;
+    int height = 2 * max_rho + 1;
+    buffers.images.reuse(hough_image, 180, height);
+    hough_image.fill(0);
+
+    // Compute each window with extra columns for the peak filter, so
+    // that the filtered columns match the full hough image.  The
+    // windows lie within degrees [90-w-pad, 269+w+pad], and degrees
+    // from 180 up are stored upside down to the opposite theta as in
+    // compute_dense_hough_image().
+    int half_width = approx_series_width + track_theta_margin;
+    int pad = hough_peak_filter_width / 2;
+    CImg<float> &raw_window = buffers.raw_hough;
+    CImg<float> &window = buffers.full_hough;
+    for (int s = 0; s < 2; s++) {
+      int theta1 = tracked_theta[s] - half_width - pad;
+      int theta2 = tracked_theta[s] + half_width + pad;
+      int num_pixels = 0;
+      im::hough(weighted_line_image, theta1, theta2, theta2 - theta1 + 1, 
+		max_rho, raw_window, buffers.hough, hough_threads, 
+		&num_pixels);
+      profile.pixels_voted += num_pixels;
+      im::peak_correlate(raw_window, hough_peak_filter_width, 1, window,
+			 &buffers.filter);
+      for (int x = pad; x < (int)window.width - pad; x++) {
+	int theta = (theta1 + x + 360) % 360;
+	for (int y = 0; y < height; y++) {
+	  if (theta < 180)
+	    hough_image(theta, y) = window(x, y);
+	  else
+	    hough_image(theta - 180, height - 1 - y) = window(x, y);
+	}
+      }
+    }
+
     im::zero_negatives(hough_image);
     hough_image.normalize(0, 1);
+    hough_image_windowed = true;
   }
 
-  void 
-  Analyser::compute_initial_grid()
+  void
+  Analyser::compute_kht_hough_image()
   {
-    if (verbose > 0)
-      fprintf(stderr, "Computing the initial grid.\n");
+    int width = line_image.width;
+    int height = line_image.height;
 
-    // First we find approximate theta-locations for the two almost
-    // vertical series of local maximums in the Hough image.  
+    // Binarize and thin the line image.  Note that kht() destroys
+    // the binary image.
+    CImg<unsigned char> binary(width, height);
+    cimg_mapXY(line_image, x, y)
+      binary(x, y) = line_image(x, y) > kht_threshold;
+    im::thin(binary);
+    cimg_mapXY(binary, x, y)
+      profile.pixels_voted += binary(x, y);
+
+    lines_list_t &kht_lines = buffers.kht_lines;
+    buffers.kht.n_threads = util::max(hough_threads, 1);
+    buffers.kht.incremental_votes = kht_incremental_votes;
+    buffers.kht.max_lines = util::max(kht_max_lines, 0);
+    kht(buffers.kht, kht_lines, binary.ptr(), width, height);
+
+    // Render the lines in the same layout as the dense hough image:
+    // degrees 0, 1, ..., 179 with the center row corresponding to
+    // lines crossing the center of the image.  The lines are splatted
+    // bilinearly to the nearest thetas and rhos, with weights
+    // decreasing linearly with the rank of the line.  A splat at 180
+    // degrees goes upside down to 0 degrees.
+    int max_rho = cimg::max(height, width) / 2;
+    int rho_center = max_rho;
+    int num_rhos = 2 * max_rho + 1;
+    buffers.images.reuse(hough_image, 180, num_rhos);
+    hough_image.fill(0);
+    int num_lines = util::min((int)kht_lines.size(), kht_max_lines);
+    for (int l = 0; l < num_lines; l++) {
+      float weight = 1 - (float)l / num_lines;
+      float theta = kht_lines[l].theta;
+      float rho = kht_lines[l].rho + rho_center;
+      int it = (int)floor(theta);
+      int ir = (int)floor(rho);
+      float wt = theta - it;
+      float wr = rho - ir;
+      for (int dt = 0; dt < 2; dt++) {
+	for (int dr = 0; dr < 2; dr++) {
+	  int t = (it + dt) % 360;
+	  int r = ir + dr;
+	  if (r < 0 || r >= num_rhos)
+	    continue;
+	  if (t >= 180) {
+	    t -= 180;
+	    r = num_rhos - 1 - r;
+	  }
+	  hough_image(t, r) += weight * (dt ? wt : 1 - wt) * 
+	    (dr ? wr : 1 - wr);
+	}
+      }
+    }
+    hough_image.normalize(0, 1);
 
+    if (verbose > 1)
+      fprintf(stderr, "KHT found %d lines, rendered %d.\n", 
+	      (int)kht_lines.size(), num_lines);
+  }
+
+  float
+  Analyser::find_approx_thetas()
+  {
     // Blur the image horizontally and compute the sum of each column.
-    CImg<float> blur_filter(5,1);
-    blur_filter.fill(1);
-    blurred_hough_image = hough_image.get_correlate(blur_filter);
-    blurred_column_sum = im::sum_y(blurred_hough_image);
+    // Both images store degrees 0, 1, ..., 179 and are read through
+    // im::HoughView, so the sums of degrees 180, 181, ..., 359 are
+    // copies.
+    buffers.images.reuse(blurred_hough_image, hough_image.width, 
+			 hough_image.height);
+    im::box_filter_x(im::HoughView<float>(hough_image), 2, 
+		     blurred_hough_image);
+    CImg<float> &column_sum = buffers.column_sum;
+    im::sum_y(im::HoughView<float>(blurred_hough_image), column_sum);
+    im::reuse_image(blurred_column_sum, column_sum.width, 1);
+    std::copy(column_sum.ptr(), column_sum.ptr() + column_sum.size(),
+	      blurred_column_sum.ptr());
     blurred_column_sum.normalize(0, 1);
 
     // Find the maximum, remove it, and find another maximum.  Note
@@ -162,6 +532,68 @@ namespace gocam {
 		   (float)0);
     approx_theta[1] = im::find_max1(blurred_column_sum, 90, 269);
 
+    // Compare the peaks to the mean of their neighbourhoods.
+    float confidence = 0;
+    for (int s = 0; s < 2; s++) {
+      float sum = 0;
+      for (int t = approx_theta[s] - approx_series_width; 
+	   t <= approx_theta[s] + approx_series_width; t++)
+	sum += column_sum(t);
+      float mean = sum / (2 * approx_series_width + 1);
+      float ratio = mean > 0 ? column_sum(approx_theta[s]) / mean : 0;
+      if (s == 0 || ratio < confidence)
+	confidence = ratio;
+    }
+    return confidence;
+  }
+
+  bool
+  Analyser::orientation_kept(float confidence)
+  {
+    if (confidence < track_min_confidence * tracked_confidence)
+      return false;
+
+    // Both series must be near one of the tracked thetas.  Note that
+    // thetas differing by 180 degrees are the same orientation.
+    for (int s = 0; s < 2; s++) {
+      int min_dist = 180;
+      for (int t = 0; t < 2; t++) {
+	int dist = cimg::abs(approx_theta[s] - tracked_theta[t]) % 180;
+	min_dist = util::min(min_dist, util::min(dist, 180 - dist));
+      }
+      if (min_dist > track_theta_margin)
+	return false;
+    }
+    return true;
+  }
+
+  void 
+  Analyser::compute_initial_grid()
+  {
+    if (verbose > 0)
+      fprintf(stderr, "Computing the initial grid.\n");
+    double start = gtimer_now();
+
+    // First we find approximate theta-locations for the two almost
+    // vertical series of local maximums in the Hough image.  If the
+    // hough image covers only the tracked windows, and the series are
+    // not found reliably, compute the full hough image.
+    orientation_confidence = find_approx_thetas();
+    if (hough_image_windowed && !orientation_kept(orientation_confidence)) {
+      if (verbose > 0)
+	fprintf(stderr, "Lost the orientation, "
+		"computing the full hough image.\n");
+      compute_dense_hough_image();
+      orientation_confidence = find_approx_thetas();
+    }
+    if (track_orientation && hough_method == HOUGH_DENSE) {
+      if (!hough_image_windowed)
+	tracked_confidence = orientation_confidence;
+      tracked_theta[0] = approx_theta[0];
+      tracked_theta[1] = approx_theta[1];
+      orientation_tracked = true;
+    }
+
     // Find best lines for both series
     for (int s = 0; s < 2; s++) {
 
@@ -169,10 +601,12 @@ namespace gocam {
       // than half of the smallest maximum.  Select at least
       // "num_initial_lines" lines, but at most "max_initial_lines" lines.
 
-      max_rho[s] = im::max_x(hough_image, 
-			     approx_theta[s] - approx_series_width,
-			     approx_theta[s] + approx_series_width);
-      std::vector<float> rho_maxes;
+      buffers.images.reuse(max_rho[s], hough_image.height, 1);
+      im::HoughView<float> hough_view(hough_image);
+      im::max_x(hough_view, approx_theta[s] - approx_series_width,
+		approx_theta[s] + approx_series_width, max_rho[s]);
+      std::vector<float> &rho_maxes = buffers.rho_maxes;
+      rho_maxes.clear();
       while (1) {
 
 	// Find a maximum
@@ -187,8 +621,9 @@ namespace gocam {
 	  break;
 
 	// Remove the maximum and the line
-	im::median_peak_remove(max_rho[s], rho, median_peak_remove_width);
-	int theta = im::find_max_x(hough_image, rho, 
+	im::median_peak_remove(max_rho[s], rho, median_peak_remove_width,
+			       (float)0, &buffers.values);
+	int theta = im::find_max_x(hough_view, rho, 
 				   approx_theta[s] - approx_series_width, 
 				   approx_theta[s] + approx_series_width);
 	initial_lines[s].push_back(geom::LineRT(rho, theta));
@@ -201,8 +636,9 @@ namespace gocam {
 
       // Compute median difference between lines
       std::sort(initial_lines[s].begin(), initial_lines[s].end());
-      std::vector<float> diff = rho_differences(initial_lines[s]);
-      float abs_median_diff = cimg::abs(util::median(diff));
+      std::vector<float> &diff = buffers.rho_diffs;
+      rho_differences(initial_lines[s], diff);
+      float abs_median_diff = cimg::abs(util::median_in_place(diff));
     
       // Fill gaps that are greater than 1.5 of the median difference,
       // by finding maximums within the gap.
@@ -217,11 +653,15 @@ namespace gocam {
 //	  exit(1);
 //	}
 
-	// Compute and remove the maximum
+	// Compute and remove the maximum.  Give up the gap if there is
+	// nothing in it, since the same line would be added forever.
 	int new_rho = im::find_max1(max_rho[s], 
 				    (int)initial_lines[s][l].rho,
 				    (int)initial_lines[s][l+1].rho);
-	im::median_peak_remove(max_rho[s], new_rho, median_peak_remove_width);
+	if (max_rho[s](new_rho) <= 0)
+	  continue;
+	im::median_peak_remove(max_rho[s], new_rho, median_peak_remove_width,
+			       (float)0, &buffers.values);
 	float new_theta = (initial_lines[s][l].theta + 
 			   initial_lines[s][l+1].theta) / 2;
 
@@ -274,6 +714,7 @@ namespace gocam {
 					line_image.dimy() / 2));
       }
     }
+    profile.initial_grid += gtimer_now() - start;
   }
 
   void
@@ -284,40 +725,455 @@ namespace gocam {
 	lines[s][l].cut(lines[1-s].front(), lines[1-s].back());
   }
   
+  /** The candidate lines of tune_line(): lines between \c n1 points
+   * evenly spaced on the segment \c d1 and \c n2 points on \c d2.
+   */
+  struct LineCandidates {
+
+    /** Create the candidates. */
+    LineCandidates(const geom::Line &d1, const geom::Line &d2, int n1, int n2)
+      : d1(d1), d2(d2), n1(n1), n2(n2), img(NULL), max_img(NULL), run(1),
+	sums(NULL), subpixel(false) { }
+
+    /** The point \c i1 on \c d1. */
+    geom::Point point1(int i1) const
+    {
+      return geom::mean(d1.a, d1.b, i1 / (n1 - 1.0));
+    }
+
+    /** The point \c i2 on \c d2. */
+    geom::Point point2(int i2) const
+    {
+      return geom::mean(d2.a, d2.b, i2 / (n2 - 1.0));
+    }
+
+    /** The candidate line between the points \c i1 and \c i2. */
+    geom::Line line(int i1, int i2) const
+    {
+      return geom::Line(point1(i1), point2(i2));
+    }
+
+    /** Move the end points of the candidate \c i1, \c i2 to the peaks
+     * of parabolas fitted to the sums of the neighbouring candidates.
+     * Meaningful only with \c subpixel, which makes the sums change
+     * smoothly with the end points.
+     *
+     * \param i1 = the point on \c d1
+     * \param i2 = the point on \c d2
+     * \param value = the sum of the candidate
+     */
+    geom::Line refine(int i1, int i2, float value) const
+    {
+      float t1 = i1;
+      float t2 = i2;
+      if (i1 > 0 && i1 < n1 - 1)
+	t1 += peak_offset(sum(line(i1 - 1, i2)), value, 
+			  sum(line(i1 + 1, i2)));
+      if (i2 > 0 && i2 < n2 - 1)
+	t2 += peak_offset(sum(line(i1, i2 - 1)), value, 
+			  sum(line(i1, i2 + 1)));
+      return geom::Line(geom::mean(d1.a, d1.b, t1 / (n1 - 1.0)),
+			geom::mean(d2.a, d2.b, t2 / (n2 - 1.0)));
+    }
+
+    /** The offset of the peak of the parabola through (-1, \c a), (0,
+     * \c b) and (1, \c c), limited to half a step.
+     */
+    static float peak_offset(float a, float b, float c)
+    {
+      float curvature = a - 2 * b + c;
+      if (curvature >= 0)
+	return 0;
+      return util::max(-0.5f, util::min(0.5f, 0.5f * (a - c) / curvature));
+    }
+
+    /** The sum of \c img along a line, computed with \c sums if
+     * given.
+     */
+    float sum(const geom::Line &line) const
+    {
+      if (subpixel)
+	return im::line_sum_subpixel(*img, line);
+      if (sums != NULL)
+	return (*sums)(line);
+      return im::line_sum(*img, line);
+    }
+
+    /** An upper bound for im::line_sum() of the candidates between
+     * the points \c i1..j1 and \c i2..j2.
+     *
+     * The pixels of all these lines lie in the convex hull of the
+     * four corner points.  im::line_sum() visits each column (or row,
+     * for steep lines) at most once, so the sum of the maximums of
+     * the hull in each column bounds the sums of the lines.  With \c
+     * subpixel, each column is a weighted mean of two pixels, so the
+     * hull is extended by a pixel.
+     *
+     * The maximums are read from \c max_img when possible.
+     */
+    float bound(int i1, int j1, int i2, int j2) const
+    {
+      geom::Point p[4] = { point1(i1), point1(j1), point2(i2), point2(j2) };
+
+      // Find out whether the lines are processed along the x- or the
+      // y-axis.  If the signs of dx and dy are fixed, |dx| - |dy| is
+      // linear and the corners decide.
+      float dx_min = 1e30, dx_max = -1e30, dy_min = 1e30, dy_max = -1e30;
+      float diff_min = 1e30, diff_max = -1e30;
+      for (int a = 0; a < 2; a++) {
+	for (int b = 2; b < 4; b++) {
+	  float dx = p[b].x - p[a].x;
+	  float dy = p[b].y - p[a].y;
+	  dx_min = util::min(dx_min, dx);
+	  dx_max = util::max(dx_max, dx);
+	  dy_min = util::min(dy_min, dy);
+	  dy_max = util::max(dy_max, dy);
+	  float diff = util::abs(dx) - util::abs(dy);
+	  diff_min = util::min(diff_min, diff);
+	  diff_max = util::max(diff_max, diff);
+	}
+      }
+      if (util::max(util::max(-dx_min, dx_max), 
+		    util::max(-dy_min, dy_max)) < 2)
+	return 1e30;
+      bool fixed_signs = (dx_min > 0 || dx_max < 0) && 
+	(dy_min > 0 || dy_max < 0);
+      float result = 0;
+      if (!fixed_signs || diff_max >= 0)
+	result = util::max(result, axis_bound(p, false));
+      if (!fixed_signs || diff_min <= 0)
+	result = util::max(result, axis_bound(p, true));
+
+      // Leave room for the rounding errors of the float sums.
+      return result * 1.0001 + 0.0001;
+    }
+
+    /** The sum of the maximums of the convex hull of \c p in each
+     * column (or in each row if \c transpose is true).
+     */
+    float axis_bound(const geom::Point *p, bool transpose) const
+    {
+      const CImg<float> &max_run = max_img[transpose ? 1 : 0];
+      const float eps = 0.01;
+      float u[4], v[4];
+      for (int k = 0; k < 4; k++) {
+	u[k] = transpose ? p[k].y : p[k].x;
+	v[k] = transpose ? p[k].x : p[k].y;
+      }
+      int nu = transpose ? img->height : img->width;
+      int nv = transpose ? img->width : img->height;
+      float u_min = util::min(util::min(u[0], u[1]), util::min(u[2], u[3]));
+      float u_max = util::max(util::max(u[0], u[1]), util::max(u[2], u[3]));
+
+      // The segments between the points cover the hull.  Compute the
+      // u-range and the slope of each segment.
+      float seg_u1[6], seg_u2[6], seg_v1[6], seg_v2[6], seg_slope[6];
+      int num_segs = 0;
+      for (int a = 0; a < 4; a++) {
+	for (int b = a + 1; b < 4; b++) {
+	  int first = u[a] <= u[b] ? a : b;
+	  int last = a + b - first;
+	  seg_u1[num_segs] = u[first];
+	  seg_u2[num_segs] = u[last];
+	  seg_v1[num_segs] = v[first];
+	  seg_v2[num_segs] = v[last];
+	  seg_slope[num_segs] = 0;
+	  if (u[last] > u[first])
+	    seg_slope[num_segs] = (v[last] - v[first]) / (u[last] - u[first]);
+	  num_segs++;
+	}
+      }
+
+      // The coordinates are rounded as in im::line_sum(), which
+      // rounds also (-1.5, -0.5) to zero.  Thus the first column may
+      // be visited twice.
+      double sum = 0;
+      int col1 = util::max((int)(u_min - eps + 0.5), 0);
+      int col2 = util::min((int)(u_max + eps + 0.5), nu - 1);
+      for (int col = col1; col <= col2; col++) {
+	float s1 = (col == 0 ? -1.5 : col - 0.5) - eps;
+	float s2 = col + 0.5 + eps;
+
+	// Clip the segments to the strip of the column.
+	float v_min = 1e30, v_max = -1e30;
+	for (int k = 0; k < num_segs; k++) {
+	  if (seg_u2[k] < s1 || seg_u1[k] > s2)
+	    continue;
+	  float va = seg_v1[k];
+	  float vb = seg_v2[k];
+	  if (seg_u2[k] > seg_u1[k]) {
+	    va += (util::max(s1, seg_u1[k]) - seg_u1[k]) * seg_slope[k];
+	    vb = seg_v1[k] + 
+	      (util::min(s2, seg_u2[k]) - seg_u1[k]) * seg_slope[k];
+	  }
+	  v_min = util::min(v_min, util::min(va, vb));
+	  v_max = util::max(v_max, util::max(va, vb));
+	}
+	int row1, row2;
+	if (subpixel) {
+	  // The pixels on both sides of the line are interpolated.
+	  row1 = util::max((int)std::floor(v_min - eps), 0);
+	  row2 = util::min((int)std::floor(v_max + eps) + 1, nv - 1);
+	}
+	else {
+	  row1 = util::max((int)(v_min - eps + 0.5), 0);
+	  row2 = util::min((int)(v_max + eps + 0.5), nv - 1);
+	}
+	float max = 0;
+	if (row2 - row1 + 1 < run) {
+	  for (int row = row1; row <= row2; row++)
+	    max = util::max(max, transpose ? (*img)(row, col) : 
+			    (*img)(col, row));
+	}
+	else {
+	  // Cover the range with runs, the last one ending at row2.
+	  for (int row = row1; ; row += run) {
+	    row = util::min(row, row2 - run + 1);
+	    max = util::max(max, transpose ? max_run(row, col) : 
+			    max_run(col, row));
+	    if (row == row2 - run + 1)
+	      break;
+	  }
+	}
+	sum += max;
+	if (col == 0)
+	  sum += max;
+      }
+      return sum;
+    }
+
+    geom::Line d1; //!< The segment of the first end point
+    geom::Line d2; //!< The segment of the second end point
+    int n1; //!< The number of points on \c d1
+    int n2; //!< The number of points on \c d2
+
+    const CImg<float> *img; //!< The line image (no negative values)
+
+    /** The maximums of runs of \c run pixels in \c img downwards and
+     * to the right.
+     */
+    const CImg<float> *max_img;
+    int run; //!< The length of the runs in \c max_img
+
+    /** The precomputed sums of \c img, or NULL to sum pixel by pixel. */
+    const im::LineSums<float> *sums;
+
+    /** Sum with im::line_sum_subpixel() instead of im::line_sum(). */
+    bool subpixel;
+  };
+
+  /** A block of candidates in tune_line(). */
+  struct CandidateBlock {
+    int i1, j1; //!< The range of points on the first segment
+    int i2, j2; //!< The range of points on the second segment
+    float bound; //!< An upper bound of the sums of the lines
+  };
+
   void
   Analyser::tune_line(geom::Line &line, geom::Line d1, geom::Line d2)
+  {
+    profile.tune_line_candidates += search_line(line, d1, d2);
+  }
+
+  long
+  Analyser::search_line(geom::Line &line, const geom::Line &d1, 
+			const geom::Line &d2) const
   {
     // Compute the number of points to test for each end point
-    int num_points_d1 = util::max((int)lrintf(d1.length() * 2), 2);
-    int num_points_d2 = util::max((int)lrintf(d2.length() * 2), 2);
+    int num_points_d1 = 
+      util::max((int)lrintf(d1.length() * tune_point_density), 2);
+    int num_points_d2 = 
+      util::max((int)lrintf(d2.length() * tune_point_density), 2);
+    LineCandidates cand(d1, d2, num_points_d1, num_points_d2);
+    cand.img = &line_image;
+    cand.max_img = line_max_image;
+    cand.run = line_max_run;
+    if (line_sums.matches(line_image))
+      cand.sums = &line_sums;
+    cand.subpixel = tune_subpixel;
 
-    // Iterate all orientations and select the best.
+    // The search below selects the same line as trying all pairs of
+    // end points in order, and keeping the first pair with the
+    // highest sum.
     float best_value = -1;
+    int best_index = -1;
+    long num_candidates = 0;
     geom::Line best_line;
-    for (int i1 = 0; i1 < num_points_d1; i1++) {
-      for (int i2 = 0; i2 < num_points_d2; i2++) {
-
-	// Compute the test end points and the sum along the test
-	// line.
-	geom::Line test_line(geom::mean(d1.a, d1.b,
-					i1 / (num_points_d1 - 1.0)),
-			     geom::mean(d2.a, d2.b,
-					i2 / (num_points_d2 - 1.0)));
-	float value = im::line_sum(line_image, test_line);
-	if (value > best_value) {
-	  best_value = value;
-	  best_line = test_line;
+    bool bounds_ok = true;
+    for (int i = 0; i < 2; i++)
+      if (line_max_image[i].width != line_image.width ||
+	  line_max_image[i].height != line_image.height)
+	bounds_ok = false;
+    if (tune_exhaustively || !bounds_ok) {
+      for (int i1 = 0; i1 < num_points_d1; i1++) {
+	for (int i2 = 0; i2 < num_points_d2; i2++) {
+
+	  // Compute the test end points and the sum along the test
+	  // line.
+	  geom::Line test_line = cand.line(i1, i2);
+	  float value = cand.sum(test_line);
+	  if (value > best_value) {
+	    best_value = value;
+	    best_index = i1 * num_points_d2 + i2;
+	    best_line = test_line;
+	  }
 	}
       }
+      line = best_line;
+      if (tune_subpixel)
+	line = cand.refine(best_index / num_points_d2, 
+			   best_index % num_points_d2, best_value);
+      return num_points_d1 * num_points_d2;
+    }
+
+    // Branch and bound: split the blocks of end point pairs in two,
+    // and skip the blocks whose bound is below the best sum found so
+    // far.  Start from the middle, which is near the old line.  Each
+    // split replaces a block with its halves, so the stack grows by
+    // at most one block for each halving of the candidates, and it
+    // fits in a fixed array.
+    CandidateBlock root = { 0, num_points_d1 - 1, 0, num_points_d2 - 1, 0 };
+    root.bound = cand.bound(root.i1, root.j1, root.i2, root.j2);
+    CandidateBlock middle = { num_points_d1 / 2, num_points_d1 / 2, 
+			      num_points_d2 / 2, num_points_d2 / 2, 1e30 };
+    CandidateBlock stack[2 + 64];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+    stack[stack_size++] = middle;
+    while (stack_size > 0) {
+      CandidateBlock block = stack[--stack_size];
+      if (block.bound < best_value)
+	continue;
+
+      // Try small blocks directly.
+      int size1 = block.j1 - block.i1 + 1;
+      int size2 = block.j2 - block.i2 + 1;
+      if (size1 * size2 <= 16) {
+	for (int i1 = block.i1; i1 <= block.j1; i1++) {
+	  for (int i2 = block.i2; i2 <= block.j2; i2++) {
+	    geom::Line test_line = cand.line(i1, i2);
+	    float value = cand.sum(test_line);
+	    int index = i1 * num_points_d2 + i2;
+	    num_candidates++;
+	    if (value > best_value || 
+		(value == best_value && index < best_index)) {
+	      best_value = value;
+	      best_index = index;
+	      best_line = test_line;
+	    }
+	  }
+	}
+	continue;
+      }
+
+      // Split the longer side, and process the more promising half
+      // first.
+      CandidateBlock half[2] = { block, block };
+      if (size1 >= size2) {
+	half[0].j1 = block.i1 + size1 / 2 - 1;
+	half[1].i1 = half[0].j1 + 1;
+      }
+      else {
+	half[0].j2 = block.i2 + size2 / 2 - 1;
+	half[1].i2 = half[0].j2 + 1;
+      }
+      for (int h = 0; h < 2; h++)
+	half[h].bound = cand.bound(half[h].i1, half[h].j1, 
+				   half[h].i2, half[h].j2);
+      if (half[0].bound > half[1].bound)
+	std::swap(half[0], half[1]);
+      stack[stack_size++] = half[0];
+      stack[stack_size++] = half[1];
     }
     line = best_line;
+    if (tune_subpixel)
+      line = cand.refine(best_index / num_points_d2, 
+			 best_index % num_points_d2, best_value);
+    return num_candidates;
+  }
+
+  void
+  Analyser::tune_segments(const std::vector<geom::Line> grid[2], int s, int l,
+			  geom::Line &d1, geom::Line &d2) const
+  {
+    const std::vector<geom::Line> &series = grid[s];
+    const std::vector<geom::Line> &other = grid[1 - s];
+    if (l > 0) {
+      d1.a = geom::mean(series[l-1].a, series[l].a, 0.3);
+      d2.a = geom::mean(series[l-1].b, series[l].b, 0.3);
+    }
+    else {
+      geom::Line imag_line = series[1].get_mirror(series[0]);
+      imag_line.cut(other[0], other.back());
+      d1.a = geom::mean(imag_line.a, series[0].a, 0.3);
+      d2.a = geom::mean(imag_line.b, series[0].b, 0.3);
+    }
+    if (l < (int)series.size() - 1) {
+      d1.b = geom::mean(series[l+1].a, series[l].a, 0.3);
+      d2.b = geom::mean(series[l+1].b, series[l].b, 0.3);
+    }
+    else {
+      geom::Line imag_line = series[l-1].get_mirror(series[l]);
+      imag_line.cut(other[0], other.back());
+      d1.b = geom::mean(imag_line.a, series[l].a, 0.3);
+      d2.b = geom::mean(imag_line.b, series[l].b, 0.3);
+    }
+
+    // Keep the test points near the end points.
+    if (tune_radius > 0) {
+      geom::Point *p[4] = { &d1.a, &d1.b, &d2.a, &d2.b };
+      for (int k = 0; k < 4; k++) {
+	const geom::Point &end = k < 2 ? series[l].a : series[l].b;
+	geom::Point delta = p[k]->get_sub(end);
+	if (delta.length() > tune_radius)
+	  *p[k] = end.get_add(delta.normalize(tune_radius));
+      }
+    }
   }
 
+  /** Tunes lines of the grid in parallel threads for
+   * Analyser::tune_grid().  Thread \c t tunes the lines \c t, \c t
+   * + \c num_threads, ... of the list.
+   */
+  struct LineTuner {
+
+    /** Create a tuner for \c num_threads threads. */
+    LineTuner(const Analyser &analyser, int num_threads)
+      : analyser(analyser), num_threads(num_threads) { }
+
+    /** Tune the lines of thread \c t. */
+    void operator()(int t)
+    {
+      for (int i = t; i < (int)line.size(); i += num_threads)
+	candidates[i] = analyser.search_line(line[i], d1[i], d2[i]);
+    }
+
+    const Analyser &analyser; //!< The analyser with the line image
+    int num_threads; //!< The number of threads
+    std::vector<geom::Line> line; //!< The lines to tune
+    std::vector<geom::Line> d1; //!< The test segments of the first end points
+    std::vector<geom::Line> d2; //!< The test segments of the second end points
+    std::vector<long> candidates; //!< The candidates tried for each line
+  };
+
   void
   Analyser::tune_grid()
   {
+    // Each line is tested between its neighbours, and the outermost
+    // lines between a neighbour and its mirror image.
+    if (lines[0].size() < 2 || lines[1].size() < 2)
+      return;
+
+    double start = gtimer_now();
     fix_end_points();
 
+    if (tune_jacobi) {
+      tune_grid_jacobi();
+      profile.tune_grid += gtimer_now() - start;
+      profile.tune_grid_calls++;
+      return;
+    }
+
     // Tune both line series
     for (int s = 0; s < 2; s++) {
     
@@ -325,31 +1181,57 @@ namespace gocam {
       for (int l = 0; l < (int)lines[s].size(); l++) {
 	geom::Line d1;
 	geom::Line d2;
-	if (l > 0) {
-	  d1.a = geom::mean(lines[s][l-1].a, lines[s][l].a, 0.3);
-	  d2.a = geom::mean(lines[s][l-1].b, lines[s][l].b, 0.3);
-	}
-	else {
-	  geom::Line imag_line = lines[s][1].get_mirror(lines[s][0]);
-	  imag_line.cut(lines[1-s][0], lines[1-s].back());
-	  d1.a = geom::mean(imag_line.a, lines[s][0].a, 0.3);
-	  d2.a = geom::mean(imag_line.b, lines[s][0].b, 0.3);
-	}
-	if (l < (int)lines[s].size() - 1) {
-	  d1.b = geom::mean(lines[s][l+1].a, lines[s][l].a, 0.3);
-	  d2.b = geom::mean(lines[s][l+1].b, lines[s][l].b, 0.3);
-	}
-	else {
-	  geom::Line imag_line = lines[s][l-1].get_mirror(lines[s][l]);
-	  imag_line.cut(lines[1-s][0], lines[1-s].back());
-	  d1.b = geom::mean(imag_line.a, lines[s][l].a, 0.3);
-	  d2.b = geom::mean(imag_line.b, lines[s][l].b, 0.3);
-	}
+	tune_segments(lines, s, l, d1, d2);
 	tune_line(lines[s][l], d1, d2);
       }
     }    
 
     fix_end_points();
+    profile.tune_grid += gtimer_now() - start;
+    profile.tune_grid_calls++;
+  }
+
+  void
+  Analyser::tune_grid_jacobi()
+  {
+    LineTuner tuner(*this, util::max(tune_threads, 1));
+    for (int sweep = 0; sweep < tune_jacobi_sweeps; sweep++) {
+
+      // Compute the test segments of all lines from the same grid.
+      tuner.line.clear();
+      tuner.d1.clear();
+      tuner.d2.clear();
+      for (int s = 0; s < 2; s++) {
+	for (int l = 0; l < (int)lines[s].size(); l++) {
+	  geom::Line d1;
+	  geom::Line d2;
+	  tune_segments(lines, s, l, d1, d2);
+	  tuner.line.push_back(lines[s][l]);
+	  tuner.d1.push_back(d1);
+	  tuner.d2.push_back(d2);
+	}
+      }
+      tuner.candidates.assign(tuner.line.size(), 0);
+      buffers.threads.run(util::min(tuner.num_threads, 
+				    (int)tuner.line.size()), tuner);
+
+      // Update the grid, and stop when the grid does not change.
+      bool changed = false;
+      int i = 0;
+      for (int s = 0; s < 2; s++) {
+	for (int l = 0; l < (int)lines[s].size(); l++, i++) {
+	  const geom::Line &line = tuner.line[i];
+	  if (line.a.x != lines[s][l].a.x || line.a.y != lines[s][l].a.y ||
+	      line.b.x != lines[s][l].b.x || line.b.y != lines[s][l].b.y)
+	    changed = true;
+	  lines[s][l] = line;
+	  profile.tune_line_candidates += tuner.candidates[i];
+	}
+      }
+      fix_end_points();
+      if (!changed)
+	break;
+    }
   }
 
   void
@@ -387,33 +1269,38 @@ namespace gocam {
     if (verbose > 0)
       fprintf(stderr, "Growing the grid.\n");
 
+    double start = gtimer_now();
     while ((int)lines[0].size() < board_size || 
 	   (int)lines[1].size() < board_size) 
     {
+      double step_start = gtimer_now();
       tune_grid();
       if ((int)lines[0].size() < board_size)
  	add_best_line(0);
       if ((int)lines[1].size() < board_size)
 	add_best_line(1);
+      profile.grow_steps.push_back(gtimer_now() - step_start);
+      profile.grow_iterations++;
       if (only_once)
 	break;
     }
     tune_grid();
+    profile.grow += gtimer_now() - start;
   }
 
-  std::vector<float>
-  Analyser::rho_differences(const std::vector<geom::LineRT> &vec)
+  void
+  Analyser::rho_differences(const std::vector<geom::LineRT> &vec,
+			    std::vector<float> &result)
   {
     // Check size
-    std::vector<float> result;
+    result.clear();
     if (vec.size() == 0)
-      return result;
+      return;
 
     // Compute differences between the rhos of the lines
     result.resize(vec.size() - 1);
     for (int i = 0; i < (int)vec.size() - 1; i++)
       result[i] = vec[i+1].rho - vec[i].rho;
-    return result;
   }
 
   float
@@ -421,26 +1308,65 @@ namespace gocam {
 			   const geom::Line &next_line,
 			   const std::vector<geom::Line> &lines)
   {
-    // Create the intersection points that correspond to the new line
-    // segments parallel to "lines".
-    std::vector<geom::Line> two_lines(1, new_line);
-    two_lines.push_back(next_line);
-    geom::Grid grid(two_lines, lines);
-
-    // Use only half of the line segments
-    for (int x = 0; x < grid.width; x++) {
-      grid(x, 0).add(grid(x, 1));
-      grid(x, 0).scale(0.5);
+    // Create the new line segments parallel to "lines" between the
+    // intersections with the new line and the next line.  Use only
+    // half of the line segments.
+    std::vector<geom::Line> &segments = buffers.segments;
+    segments.clear();
+    for (int l = 0; l < (int)lines.size(); l++) {
+      geom::Point mid = new_line.intersection(lines[l]);
+      geom::Point next = next_line.intersection(lines[l]);
+      mid.add(next);
+      mid.scale(0.5);
+      segments.push_back(geom::Line(mid, next));
     }
     
     // Compute the average of the pixel values at the new line segments.
-    im::PixelSum<float> sum(line_image);
-    for (int l = 0; l < (int)lines.size(); l++) {
-      geom::Line segment(grid(l, 0), grid(l, 1));
-      segment.map(sum);
+    if (!line_sums.matches(line_image)) {
+      im::PixelSum<float> sum(line_image);
+      for (int l = 0; l < (int)segments.size(); l++)
+	segments[l].map(sum);
+      if (sum.count == 0)
+	return 0;
+      return sum.sum / sum.count;
     }
+    double sum = 0;
+    int count = 0;
+    for (int l = 0; l < (int)segments.size(); l++) {
+      int line_count;
+      sum += line_sums(segments[l], &line_count);
+      count += line_count;
+    }
+
+    if (count == 0)
+      return 0;
+    return sum / count;
+  }
 
-    return sum.sum / sum.count;
+  float
+  Analyser::grid_strength()
+  {
+    std::vector<geom::Line> &grid_lines = buffers.segments;
+    grid_lines.assign(lines[0].begin(), lines[0].end());
+    grid_lines.insert(grid_lines.end(), lines[1].begin(), lines[1].end());
+    if (!line_sums.matches(line_image)) {
+      im::PixelSum<float> sum(line_image);
+      for (int l = 0; l < (int)grid_lines.size(); l++)
+	grid_lines[l].map(sum);
+      if (sum.count == 0)
+	return 0;
+      return sum.sum / sum.count;
+    }
+    double sum = 0;
+    int count = 0;
+    for (int l = 0; l < (int)grid_lines.size(); l++) {
+      int line_count;
+      sum += line_sums(grid_lines[l], &line_count);
+      count += line_count;
+    }
+    if (count == 0)
+      return 0;
+    return sum / count;
   }
 
 };
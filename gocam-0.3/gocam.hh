@@ -25,7 +25,10 @@ USA.
 #define GOCAM_HH
 
 #include "geom.hh"
+#include "im.hh"
 #include "CImg.h"
+#include "../kernel_hough/kht.h"
+#include <cstdio>
 #include <vector>
 
 using namespace cimg_library;
@@ -39,6 +42,106 @@ using namespace cimg_library;
 /** Main classes for the gocam analysis. */
 namespace gocam {
 
+  /** The methods for computing the Hough image. */
+  enum HoughMethod {
+    /** Dense Hough transform of the weighted line image (im::hough). */
+    HOUGH_DENSE,
+
+    /** Kernel-based Hough transform (KHT) of the thinned line image.
+     * The detected lines are rendered as peaks in the Hough image.
+     * Each Analyser has its own kht_context_t, so Analysers in
+     * different threads can use this method at once.
+     */
+    HOUGH_KHT
+  };
+
+  /** Timings and counters of the analysis of one image.
+   *
+   * The times are in seconds from a monotonic clock.  Each time
+   * covers the step called directly, so the time of tune_grid() is
+   * included also in the time of grow_grid().  The Analyser does not
+   * load images, so \ref load and \ref total are left for the caller
+   * to fill.
+   */
+  struct Profile {
+    /** The default constructor clears the profile. */
+    Profile();
+
+    /** Clear the timings and counters. */
+    void clear();
+
+    /** Print the profile as a JSON object on one line. */
+    void print(FILE *file) const;
+
+    double total; //!< The time of the whole call of the caller
+    double load; //!< The time of loading the image
+    double reset; //!< The time of Analyser::reset()
+    double line_images; //!< The time of Analyser::compute_line_images()
+    double hough; //!< The time of Analyser::compute_hough_image()
+    double initial_grid; //!< The time of Analyser::compute_initial_grid()
+    double grow; //!< The time of Analyser::grow_grid()
+    double refine; //!< The time of Analyser::refine_grid()
+    double track; //!< The time of Analyser::track()
+    double tune_grid; //!< The total time of Analyser::tune_grid()
+
+    /** The time of each iteration of Analyser::grow_grid(). */
+    std::vector<double> grow_steps;
+
+    /** The number of pixels voted in the Hough transform.  A pixel
+     * voting in several theta windows is counted once for each.
+     */
+    long pixels_voted;
+
+    int grow_iterations; //!< The number of iterations of grow_grid()
+    int tune_grid_calls; //!< The number of calls to tune_grid()
+
+    /** The number of candidate lines evaluated by tune_line(). */
+    long tune_line_candidates;
+
+    /** The peak resident memory of the whole process in kilobytes at
+     * the end of the analysis.
+     */
+    long peak_memory;
+  };
+
+  /** The work buffers of Analyser.
+   *
+   * The buffers are kept over images, so that once they have grown
+   * to the sizes needed, successive gray-scale images of the same
+   * size are analysed without allocating memory (except with
+   * Analyser::tune_jacobi and HOUGH_KHT).  The images of each size
+   * seen, such as the levels of the pyramid and the regions of
+   * Analyser::track(), are kept in \ref images.  The contents of the
+   * buffers are only meaningful within the step that fills them.
+   */
+  struct AnalyserBuffers {
+    AnalyserBuffers() { hough.threads = &threads; }
+
+    /** The threads of im::hough() and the parallel tune_grid(). */
+    util::ThreadPool threads;
+
+    im::ImagePool<float> images; //!< The pooled image buffers
+    im::ImagePool<double> sum_images; //!< The pooled buffers of LineSums
+    im::FilterBuffers<float> filter; //!< The buffers of the peak filters
+    im::HoughBuffers<float> hough; //!< The buffers of im::hough()
+    CImg<float> raw_hough; //!< The Hough transform before filtering
+    CImg<float> full_hough; //!< The Hough transform with wrapped columns
+    CImg<float> column_sum; //!< The column sums of the Hough image
+    std::vector<double> row; //!< The row sums of im::downsample()
+    std::vector<float> values; //!< Values for medians
+    std::vector<float> rho_maxes; //!< The maximums of the initial lines
+    std::vector<float> rho_diffs; //!< The differences of the initial lines
+
+    /** The segments summed in score_new_line() and grid_strength(). */
+    std::vector<geom::Line> segments;
+
+    /** The grid of the previous frame in Analyser::track(). */
+    std::vector<geom::Line> old_lines[2];
+
+    kht_context_t kht; //!< The buffers of kht()
+    lines_list_t kht_lines; //!< The lines found by kht()
+  };
+
   /** A class for analysing images of go boards and storing various
    * information about the analysis.
    *
@@ -51,24 +154,65 @@ namespace gocam {
    * \li compute_hough_image()
    * \li compute_initial_grid()
    * \li grow_grid()
+   * \li refine_grid() (only with \ref pyramid_width)
    *
    * The compute_hough_image() method does nothing, if the x- and
    * y-dimensions of \ref hough_image are already positive.  This
    * allows the use of a precomputed hough image when new analysis
    * features are tested in later phases.
+   *
+   * When analysing successive frames of the same board, \ref
+   * track_orientation can be set to compute the dense Hough image
+   * only in narrow theta windows around the series found in the
+   * previous frame.  The tracking state is kept over reset(), and
+   * the full Hough image is computed again if the series are not
+   * found confidently inside the windows.
+   *
+   * If the board has hardly moved, track() finds the grid of the
+   * next frame faster: it only tunes the previous grid in a region
+   * around it, and tells how well the grid was found.
    */
   struct Analyser {
     /** The Default constructor */
     Analyser();
 
     /** Reset the class for analysing a new image. 
+     *
+     * The orientation tracked from the previous image is kept.
+     *
      *	\param img = the image to analyse
      */
     void reset(const CImg<float> &img);
 
+    /** Forget the tracked orientation, so that the next image is
+     * analysed with the full Hough image.
+     */
+    void forget_orientation();
+
     /** Complete analyse of the image. */
     void analyse();
 
+    /** Find the grid of the previous analyse() or track() in a new
+     * frame of the same board.
+     *
+     * The frame is cropped to the grid padded by \ref track_padding,
+     * keeping the size of the region of the first track() after
+     * analyse(), and the old grid is tuned at the same level of the pyramid
+     * with tune_grid() \ref track_iterations times.  The initial
+     * grid is not searched, so the board must not move more than
+     * about a third of a square.  The movement of the corners is
+     * stored in \ref track_drift.
+     *
+     * \param img = the new frame (the size of the previous frame)
+     * \return the ratio of grid_strength() to its value after the
+     * last analyse(), or 0 if there is no complete grid of at least
+     * two lines in each direction to track or the frame is too small
+     * for it (the grid is then kept).  A
+     * ratio well below one means that the board was lost, and
+     * analyse() should be called.
+     */
+    float track(const CImg<float> &img);
+
     /** Compute the line image in \ref line_image. */
     void compute_line_images();
 
@@ -95,6 +239,15 @@ namespace gocam {
     void fix_end_points();
     
     /** Tune a single line to match the line image. 
+     *
+     * The line is moved to the pair of test points with the highest
+     * im::line_sum() in \ref line_image.  Unless \ref
+     * tune_exhaustively is set, the pairs are searched hierarchically
+     * by splitting blocks of pairs and skipping the blocks that can
+     * not contain a better line.  The result is the same as with the
+     * exhaustive search.  If \ref tune_subpixel is set, the sums are
+     * sub-pixel sums, and the end points are refined between the
+     * test points.
      *
      * \warning Does not check that the line stays inside the image
      * boundaries.
@@ -107,7 +260,15 @@ namespace gocam {
 
     /** Tune the grid lines to match the line image. 
      *
-     * \note Assumes that the grid lines are sorted correctly.
+     * By default, the lines are tuned one at a time, and each line
+     * is tested between the already tuned previous line and the next
+     * line (Gauss-Seidel order).  If \ref tune_jacobi is set, all
+     * lines are tuned in parallel between the lines of the previous
+     * sweep (see tune_grid_jacobi()).
+     *
+     * \note Assumes that the grid lines are sorted correctly.  A
+     * grid with less than two lines in either series is left as it
+     * is.
      */
     void tune_grid();
 
@@ -122,19 +283,101 @@ namespace gocam {
      */
     void add_best_line(int series);
 
+    /** Move the grid to the next finer level of the image pyramid:
+     * scale the lines up by two, compute the line images at the new
+     * level, and tune the grid near the old lines (see \ref
+     * pyramid_refine_radius).
+     */
+    void refine_grid();
+
+    /** The power of two by which analyse() scales the image down for
+     * the coarse level of the pyramid (see \ref pyramid_width).
+     */
+    int pyramid_factor() const;
+
+    /** Map a point of \ref line_image to the coordinates of the
+     * frame given to reset() or track().
+     */
+    geom::Point image_point(const geom::Point &point) const;
+
     /** Grow the grid to the full size. */
     
 
   private:
 
+    friend struct LineTuner;
+
+    /** Find the best line for tune_line() without updating \ref
+     * profile.  Safe to call from several threads at a time.
+     *
+     * \return the number of candidate lines scored
+     */
+    long search_line(geom::Line &line, const geom::Line &d1, 
+		     const geom::Line &d2) const;
+
+    /** Compute the test segments of the end points for tuning a line.
+     * \param grid = the two line series
+     * \param s = the series of the line
+     * \param l = the index of the line in the series
+     * \param d1 = the test segment of the first end point
+     * \param d2 = the test segment of the second end point
+     */
+    void tune_segments(const std::vector<geom::Line> grid[2], int s, int l,
+		       geom::Line &d1, geom::Line &d2) const;
+
+    /** Tune all lines of the grid in parallel from the same grid,
+     * and repeat until the grid does not change or \ref
+     * tune_jacobi_sweeps sweeps have been made.
+     */
+    void tune_grid_jacobi();
+
+    /** Compute the hough image with the dense Hough transform. */
+    void compute_dense_hough_image();
+
+    /** Compute the dense hough image only in the theta windows
+     * around \ref tracked_theta.  The columns outside the windows are
+     * zero.
+     */
+    void compute_windowed_hough_image();
+
+    /** Find the approximate thetas of the two series in the Hough
+     * image.
+     *
+     * \return the confidence of the orientation: the smaller ratio
+     * between a peak of the column sums of \ref blurred_hough_image
+     * and the mean of the column sums within \ref
+     * approx_series_width of the peak.
+     */
+    float find_approx_thetas();
+
+    /** Check if the series found in a windowed hough image can be
+     * trusted.
+     *
+     * \param confidence = the confidence returned by find_approx_thetas()
+     * \return true if both series are within \ref track_theta_margin
+     * of the tracked thetas, and the confidence has not dropped below
+     * \ref track_min_confidence times the confidence of the last full
+     * Hough image.
+     */
+    bool orientation_kept(float confidence);
+
+    /** Compute the hough image with the kernel-based Hough transform. 
+     *
+     * The line image is thresholded and thinned, and the lines found
+     * by kht() are rendered in \ref hough_image as peaks whose height
+     * decreases with the rank of the line.
+     */
+    void compute_kht_hough_image();
+
     /** Compute differences of the rhos of the lines. 
      *
      * \note Assumes that the vector of lines is sorted already.
      *
      * \param vec = a vector of lines
-     * \return a vector containing differences between the rhos of the lines.
+     * \param result = the differences between the rhos of the lines
      */
-    std::vector<float> rho_differences(const std::vector<geom::LineRT> &vec);
+    void rho_differences(const std::vector<geom::LineRT> &vec,
+			 std::vector<float> &result);
 
     /** Compute the score of the addition of a new line. 
      * \param new_line = the new line to add at the edge of the grid
@@ -147,6 +390,11 @@ namespace gocam {
 			 const geom::Line &next_line,
 			 const std::vector<geom::Line> &lines);
 
+    /** Compute the mean of \ref line_image on the pixels of the grid
+     * lines. 
+     */
+    float grid_strength();
+
   public:
 
     /** @name Parameters for the analysis */
@@ -168,6 +416,62 @@ namespace gocam {
      */
     int hough_peak_filter_width; 
 
+    /** The method for computing the Hough image (default HOUGH_DENSE). */
+    HoughMethod hough_method;
+
+    /** The threshold for binarizing the line image for the
+     * kernel-based Hough transform (default 0.15).
+     */
+    float kht_threshold;
+
+    /** The maximum number of lines rendered from the kernel-based
+     * Hough transform (default 60).  kht() only extracts this many
+     * peaks from its accumulator.
+     */
+    int kht_max_lines;
+
+    /** Evaluate the Gaussian kernels of kht() incrementally instead
+     * of calling exp() for each vote (default false).  A bin of the
+     * accumulator may differ by one from the exact votes.
+     */
+    bool kht_incremental_votes;
+
+    /** The number of threads used to compute the Hough transform
+     * (default 1).
+     *
+     * The result is exactly reproducible for a fixed number of
+     * threads.  With HOUGH_KHT, the threads fit and vote the kernels
+     * of kht(), and the result does not depend on the number of
+     * threads.
+     */
+    int hough_threads;
+
+    /** Track the orientation of the board between successive
+     * images (default false).  Only used with HOUGH_DENSE.
+     */
+    bool track_orientation;
+
+    /** The margin in degrees added to \ref approx_series_width
+     * around the tracked thetas, and the amount the series may drift
+     * between images before the full Hough image is computed again
+     * (default 3).
+     */
+    int track_theta_margin;
+
+    /** The minimum confidence of a tracked orientation relative to
+     * the confidence of the last full Hough image (default 0.7).
+     */
+    float track_min_confidence;
+
+    /** The margin added around the grid on each side in track(), as
+     * a fraction of the width and the height of the grid (default
+     * 0.15).
+     */
+    float track_padding;
+
+    /** The number of times track() tunes the grid (default 2). */
+    int track_iterations;
+
     /** The standard deviation of the centered Gaussian to get the
      * weighted line image.
      *
@@ -177,6 +481,57 @@ namespace gocam {
      */
     float line_image_sigma;
 
+    /** Try all pairs of test points in tune_line() (default false).
+     * The result is the same, but slower.
+     */
+    bool tune_exhaustively;
+
+    /** The length of the runs in \ref line_max_image (default 4). */
+    int line_max_run;
+
+    /** Score the lines in tune_line() with im::line_sum_subpixel()
+     * instead of rounding to whole pixels, and move the end points
+     * of the best line between the test points by fitting parabolas
+     * to the scores of the neighbouring lines (default false).
+     */
+    bool tune_subpixel;
+
+    /** The number of test points per pixel on the test segments of
+     * tune_line() (default 2).
+     */
+    float tune_point_density;
+
+    /** Tune all lines of the grid in parallel from the previous grid
+     * (Jacobi order) instead of one line at a time (default false).
+     * The lines usually end up at the same place, but not always.
+     */
+    bool tune_jacobi;
+
+    /** The maximum number of sweeps of the Jacobi tuning in one call
+     * of tune_grid() (default 1).  The sweeps stop earlier if a sweep
+     * does not move any line.
+     */
+    int tune_jacobi_sweeps;
+
+    /** The number of threads used for the Jacobi tuning (default 1). */
+    int tune_threads;
+
+    /** The minimum width of the coarse level of the image pyramid
+     * (default 0 = no pyramid).
+     *
+     * If the image is at least twice as wide, analyse() scales it
+     * down by the largest power of two that keeps it this wide.  The
+     * grid is found and grown on the coarse level, and then tuned
+     * once on the next finer level (see refine_grid()).  Thus the
+     * time stays about the same for larger images.
+     */
+    int pyramid_width;
+
+    /** The distance in pixels refine_grid() searches around the end
+     * points of the scaled-up lines (default 3).
+     */
+    float pyramid_refine_radius;
+
     /** The approximate maximum width of the series used for the
      * initial grid (default 10). */
     int approx_series_width;
@@ -210,18 +565,62 @@ namespace gocam {
     /** The line image weighted with a centered Gaussian. */
     CImg<float> weighted_line_image; 
 
-    /** Hough transform of the weighted line image. */
+    /** The maximums of \ref line_image over \ref line_max_run
+     * pixels downwards (0) and to the right (1).  Used for bounding
+     * the line sums in tune_line().
+     */
+    CImg<float> line_max_image[2];
+
+    /** The running sums of \ref line_image for summing it along the
+     * lines in tune_line() and score_new_line().
+     */
+    im::LineSums<float> line_sums;
+
+    /** Hough transform of the weighted line image.  Only degrees 0,
+     * 1, ..., 179 are stored; im::HoughView reads the degrees up to
+     * 359 from the same columns upside down.
+     */
     CImg<float> hough_image; 
 
-    /** Horizontally blurred version of the Hough transform. */
+    /** Horizontally blurred version of the Hough transform (degrees
+     * 0, 1, ..., 179 as in \ref hough_image). 
+     */
     CImg<float> blurred_hough_image; 
 
-    /** The sum of columns of \c blurred_hough_image. */
+    /** The sum of columns of \c blurred_hough_image over 360 degrees. */
     CImg<float> blurred_column_sum;
 
     /** The approximate positions of the vertical series of maximums. */
     int approx_theta[2];
 
+    /** The confidence of \ref approx_theta (see find_approx_thetas()). */
+    float orientation_confidence;
+
+    /** True if \ref hough_image was computed only in the tracked
+     * theta windows.
+     */
+    bool hough_image_windowed;
+
+    /** The ratio of the size of \ref image to the size of \ref
+     * line_image (1 unless the pyramid is used, see \ref
+     * pyramid_width).  The lines are in the coordinates of \ref
+     * line_image; image_point() maps them to the frame.
+     */
+    int line_image_scale;
+
+    /** The position of \ref image in the frame given to reset() or
+     * track() (nonzero only if track() has cropped the frame).
+     */
+    int image_x, image_y;
+
+    /** The image scaled down by \ref line_image_scale. */
+    CImg<float> scaled_image;
+
+    /** The maximum distance of the test points from the end points
+     * of the lines in tune_segments() (0 = no limit).
+     */
+    float tune_radius;
+
     /** Vertical maximum cuts of the series. */
     CImg<float> max_rho[2];
 
@@ -241,6 +640,60 @@ namespace gocam {
 
     //@}
 
+
+
+    /** @name Profiling */
+    //@{
+
+    /** The timings and counters of the analysis since the last
+     * reset().  gocam_analyse() and gocam_track() print it if \ref
+     * verbose is positive.
+     */
+    Profile profile;
+
+    //@}
+
+    /** The work buffers kept over images. */
+    AnalyserBuffers buffers;
+
+
+
+    /** @name Orientation tracking over successive images */
+    //@{
+
+    /** True if \ref tracked_theta contains the orientation of the
+     * previous image. 
+     */
+    bool orientation_tracked;
+
+    /** The approximate thetas of the series in the previous image. */
+    int tracked_theta[2];
+
+    /** The confidence of the orientation in the last full Hough image. */
+    float tracked_confidence;
+
+    //@}
+
+    /** @name Grid tracking over successive frames */
+    //@{
+
+    /** The grid_strength() after the last analyse() with a complete
+     * grid, or 0. 
+     */
+    float tracked_strength;
+
+    /** The largest distance in pixels a corner of the grid moved in
+     * the last track().
+     */
+    float track_drift;
+
+    /** The size of the region that track() crops, fixed by the first
+     * track() after analyse() (0 = not fixed yet).
+     */
+    int track_width, track_height;
+
+    //@}
+
   };
 
 };
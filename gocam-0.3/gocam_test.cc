@@ -1,36 +1,58 @@
 #include "gocam.hh"
-#include "conf.hh"
+#include "gocam_test.h"
 #include "gtimer.h"
+#include "load.hh"
+#include <cstdlib>
+#include <cstring>
+#include <new>
 
-/** The configuration options of the program. */
-conf::Config config;
-gocam::Analyser analyser;
+/** The state of the analysis of successive images. */
+struct gocam_context {
+  gocam::Analyser analyser; //!< The analyser and its buffers
+  CImg<float> image; //!< The image being analysed
 
+  /** The minimum width for JPEG images scaled down while decoding
+   * (0 = do not scale). 
+   */
+  int analysis_width;
 
+  /** The directory of the temporary files of images converted by
+   * CImg, or NULL for cimg::temporary_path().
+   */
+  char *temp_path;
+};
+
+
+/** Draw the grid lines and store the end points of the first and
+ * the last horizontal line in \c result.  The end points are
+ * multiplied by \c scale to map them to the original image. 
+ */
 void
-draw_grid(CImg<float> &img, float *rgb, int *result)
+draw_grid(const gocam::Analyser &analyser, CImg<float> &img, float *rgb, 
+	  int *result, float scale = 1)
 {
   float red[3] = {1.0, 0.0, 0.0};
   for (int s = 0; s < 2; s++) {
     for (int l = 0; l < (int)analyser.lines[s].size(); l++) {
-      geom::Line line = analyser.lines[s][l];
+      geom::Line line(analyser.image_point(analyser.lines[s][l].a),
+		      analyser.image_point(analyser.lines[s][l].b));
       line.add(geom::Point(0.5, 0.5));
       img.draw_line((int)line.a.x, (int)line.a.y, 
 		    (int)line.b.x, (int)line.b.y, rgb);
 		    if(s == 0) {
 		      if((l == 0) || (l == (int)analyser.lines[s].size() - 1)) {
                   if(l == 0) {
-                      result[0] = (int)line.a.x;
-                      result[1] = (int)line.a.y;
-                      result[2] = (int)line.b.x;
-                      result[3] = (int)line.b.y;
+                      result[0] = (int)(line.a.x * scale);
+                      result[1] = (int)(line.a.y * scale);
+                      result[2] = (int)(line.b.x * scale);
+                      result[3] = (int)(line.b.y * scale);
                   } else {
-                      result[4] = (int)line.a.x;
-                      result[5] = (int)line.a.y;
-                      result[6] = (int)line.b.x;
-                      result[7] = (int)line.b.y;
+                      result[4] = (int)(line.a.x * scale);
+                      result[5] = (int)(line.a.y * scale);
+                      result[6] = (int)(line.b.x * scale);
+                      result[7] = (int)(line.b.y * scale);
                   }
-		        printf("%d,%d,%d,%d%s",(int)line.a.x, (int)line.a.y, (int)line.b.x, (int)line.b.y, l==0?",":"");
+		        printf("%d,%d,%d,%d%s",(int)(line.a.x * scale), (int)(line.a.y * scale), (int)(line.b.x * scale), (int)(line.b.y * scale), l==0?",":"");
 	          img.draw_line((int)line.a.x, (int)line.a.y, 
 		    (int)line.b.x, (int)line.b.y, red);      
 		      }
@@ -41,7 +63,7 @@ draw_grid(CImg<float> &img, float *rgb, int *result)
 }
 
 void
-analyse_step_by_step()
+analyse_step_by_step(gocam::Analyser &analyser)
 {
   float white[1] = {1};
   int result[8];
@@ -60,64 +82,176 @@ analyse_step_by_step()
     analyser.add_best_line(1);
     analyser.tune_grid();
      tmp = analyser.line_image;
-     draw_grid(tmp, white, result);
+     draw_grid(analyser, tmp, white, result);
   }
 }
 
 
-#ifdef __cplusplus
 extern "C" {
-#endif
-    
+
+gocam_context_t *
+gocam_create(const char *tempfilepath)
+{
+  gocam_context_t *context = new (std::nothrow) gocam_context_t;
+  if (context == NULL)
+    return NULL;
+  context->temp_path = NULL;
+  if (tempfilepath != NULL) {
+    context->temp_path = strdup(tempfilepath);
+    if (context->temp_path == NULL) {
+      delete context;
+      return NULL;
+    }
+  }
+  context->analyser.verbose = 0;
+  context->analysis_width = 0;
+  return context;
+}
+
+void
+gocam_set_analysis_width(gocam_context_t *context, int width)
+{
+  context->analysis_width = width;
+}
+
+void
+gocam_set_pyramid_width(gocam_context_t *context, int width)
+{
+  context->analyser.pyramid_width = width;
+}
+
+/** Load an image to \c context->image for gocam_analyse() and
+ * gocam_track().  The scale of the image is stored in \c scale.
+ * \return the time of loading the image
+ */
+static double
+load_image(gocam_context_t *context, const char *imgfilename, float *scale)
+{
+  double start = gtimer_now();
+
+  // Load image file.  JPEG and PNG images are decoded directly to
+  // gray-scale, other formats are converted by CImg.
+  if (!im::load_gray(imgfilename, context->image, 
+		     context->analysis_width, scale)) {
+    CImg<float>::load(imgfilename, context->temp_path).swap(context->image);
+    *scale = 1;
+  }
+  double load_time = gtimer_now() - start;
+  context->image.normalize(0, 1);
+  return load_time;
+}
+
+/** Store the load and total times of a call of gocam_analyse() or
+ * gocam_track() that started at \c start in the profile of the
+ * analyser, and print the profile if the analyser is verbose.
+ */
+static void
+finish_profile(gocam_context_t *context, double start, double load_time)
+{
+  gocam::Analyser &analyser = context->analyser;
+  analyser.profile.load = load_time;
+  analyser.profile.total = gtimer_now() - start;
+  if (analyser.verbose > 0)
+    analyser.profile.print(stderr);
+}
+
 int
-run_gocam(char *imgfilename, int result[8], const char* tempfilepath)
+gocam_analyse(gocam_context_t *context, const char *imgfilename, int *result)
 {
-    gtimer_t *overall = create_gtimer();
-    gtimer_t *load = create_gtimer();
-    gtimer_t *normalize = create_gtimer();
-    gtimer_t *reset = create_gtimer();
-    gtimer_t *analyze = create_gtimer();
-    gtimer_t *drawgrid = create_gtimer();
-    
-    start_gtimer(overall);
-    
-    cimg::set_temporary_path(tempfilepath);
-    
-        
-   // Load image file and possible pre-computed hough image
-   start_gtimer(load);
-   CImg<float> original_image(imgfilename);
-   stop_gtimer(load);
-    
-    start_gtimer(normalize);
-   original_image.normalize(0, 1);
-    stop_gtimer(normalize);
+    gocam::Analyser &analyser = context->analyser;
+    float scale = 1;
+    double start = gtimer_now();
+    double load_time = 0;
     
-    start_gtimer(reset);
-   analyser.reset(original_image);
-    stop_gtimer(reset);
-    
-    start_gtimer(analyze);
+  analyser.profile.clear();
+  try {
+   load_time = load_image(context, imgfilename, &scale);
+   analyser.reset(context->image);
    analyser.analyse();
-    stop_gtimer(analyze);
-
 
   // Display result
     float blue[3] = {0, 0, 1};
-    
-    start_gtimer(drawgrid);
-    draw_grid(original_image, blue, result);
-    stop_gtimer(drawgrid);
+    draw_grid(analyser, context->image, blue, result, scale);
+  }
+  catch (CImgException &) {
+    // CImg has already reported the error.
+    return -1;
+  }
  
-    
-    stop_gtimer(overall);
-    printf("gocam ET: %f\n", elapsed_seconds(overall));
-    printf("load: %f normalize: %f reset: %f\n", elapsed_seconds(load), elapsed_seconds(normalize), elapsed_seconds(reset));
-    printf("analyze: %f drawgrid: %f\n", elapsed_seconds(analyze), elapsed_seconds(drawgrid));
-    
+    finish_profile(context, start, load_time);
     return(0);
   
 }
-#ifdef __cplusplus
+
+int
+gocam_track(gocam_context_t *context, const char *imgfilename, int *result,
+	    float *strength)
+{
+  gocam::Analyser &analyser = context->analyser;
+  float scale = 1;
+  double start = gtimer_now();
+  double load_time = 0;
+
+  *strength = 0;
+  analyser.profile.clear();
+  try {
+    load_time = load_image(context, imgfilename, &scale);
+    *strength = analyser.track(context->image);
+    if (*strength == 0) {
+      finish_profile(context, start, load_time);
+      return -1;
+    }
+    float blue[3] = {0, 0, 1};
+    draw_grid(analyser, context->image, blue, result, scale);
+  }
+  catch (CImgException &) {
+    // CImg has already reported the error.
+    return -1;
+  }
+  finish_profile(context, start, load_time);
+  return 0;
+}
+
+void
+gocam_get_profile(const gocam_context_t *context, gocam_profile_t *profile)
+{
+  const gocam::Profile &p = context->analyser.profile;
+  profile->total = p.total;
+  profile->load = p.load;
+  profile->reset = p.reset;
+  profile->line_images = p.line_images;
+  profile->hough = p.hough;
+  profile->initial_grid = p.initial_grid;
+  profile->grow = p.grow;
+  profile->refine = p.refine;
+  profile->track = p.track;
+  profile->tune_grid = p.tune_grid;
+  profile->grow_steps = p.grow_steps.empty() ? NULL : &p.grow_steps[0];
+  profile->grow_iterations = p.grow_iterations;
+  profile->pixels_voted = p.pixels_voted;
+  profile->tune_grid_calls = p.tune_grid_calls;
+  profile->tune_line_candidates = p.tune_line_candidates;
+  profile->peak_memory = p.peak_memory;
+}
+
+void
+gocam_destroy(gocam_context_t *context)
+{
+  if (context != NULL)
+    std::free(context->temp_path);
+  delete context;
+}
+
+int
+run_gocam(const char *imgfilename, int result[8], const char* tempfilepath)
+{
+  gocam_context_t *context = gocam_create(tempfilepath);
+  if (context == NULL)
+    return -1;
+  context->analyser.verbose = 1;
+  int ret = gocam_analyse(context, imgfilename, result);
+  gocam_destroy(context);
+  return ret;
+}
+
 }
-#endif
\ No newline at end of file
@@ -5,10 +5,89 @@
 extern "C" {
 #endif
 
+/* An analysis context.  All state of the analysis lives in the
+ * context, so different contexts can be used concurrently from
+ * different threads.  A single context must not be used by two
+ * threads at the same time. */
+typedef struct gocam_context gocam_context_t;
 
+/* Create a context.  Images that are not JPEG or PNG are converted
+ * in the directory tempfilepath, which the context copies; NULL uses
+ * the default path of CImg.  Returns NULL on failure. */
+gocam_context_t *gocam_create(const char *tempfilepath);
+
+/* Decode JPEG images wider than twice the given width at 1/2, 1/4 or
+ * 1/8 scale, keeping them at least width pixels wide.  The corners
+ * are still returned in the pixels of the original image.  The
+ * default 0 analyses images at full resolution. */
+void gocam_set_analysis_width(gocam_context_t *context, int width);
+
+/* Find the grid on a copy of the image scaled down by a power of two
+ * to at least the given width, and tune it once at twice that size
+ * (see gocam::Analyser::pyramid_width).  The corners are still
+ * returned in the pixels of the original image.  The default 0 finds
+ * the grid at full resolution. */
+void gocam_set_pyramid_width(gocam_context_t *context, int width);
+
+/* Analyse an image and store the end points of the first and the
+ * last horizontal line in result (x1, y1, x2, y2 for both lines).
+ * The buffers of the context are reused by later calls.  Returns 0
+ * on success and -1 if the image could not be analysed. */
+int gocam_analyse(gocam_context_t *context, const char *imgfilename,
+                  int *result);
+
+/* Find the grid of the previous gocam_analyse() or gocam_track() in
+ * a new image of the same board, and store the corners in result as
+ * gocam_analyse() does.  Only the old grid is tuned in a region
+ * around it (see gocam::Analyser::track()).  The strength of the
+ * grid relative to the last gocam_analyse() is stored in strength;
+ * if it is well below one, the board has moved and gocam_analyse()
+ * should be called.  Returns 0 on success and -1 if there was no
+ * grid to track or the image could not be loaded. */
+int gocam_track(gocam_context_t *context, const char *imgfilename,
+                int *result, float *strength);
+
+/* Timings and counters of the last gocam_analyse() or gocam_track()
+ * call.  The times are in seconds from a monotonic clock.  The steps
+ * of the analysis are described in gocam::Profile. */
+typedef struct {
+  double total;
+  double load;
+  double reset;
+  double line_images;
+  double hough;
+  double initial_grid;
+  double grow;
+  double refine;
+  double track;
+  double tune_grid;
+
+  /* The time of each grow iteration.  Points to the context, and is
+   * valid until the next call to gocam_analyse(). */
+  const double *grow_steps;
+  int grow_iterations;
+
+  long pixels_voted;
+  int tune_grid_calls;
+  long tune_line_candidates;
+
+  /* The peak resident memory of the process in kilobytes. */
+  long peak_memory;
+} gocam_profile_t;
+
+/* Fill profile with the timings and counters of the last call to
+ * gocam_analyse() or gocam_track().  When the analyser of the context is
+ * verbose, the same data is also printed as one JSON line to stderr. */
+void gocam_get_profile(const gocam_context_t *context,
+                       gocam_profile_t *profile);
+
+/* Destroy a context created by gocam_create(). */
+void gocam_destroy(gocam_context_t *context);
+
+/* Analyse a single image with a temporary context. */
 int run_gocam(const char *imgfilename, int *result, const char *tempfilepath);
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
@@ -3,24 +3,57 @@ extern "C" {
 #endif
 
 #include <stdlib.h>
+#include <sys/resource.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
 #include <gtimer.h>
 
 gtimer_t *create_gtimer() {
   return((gtimer_t *)malloc(sizeof(gtimer_t)));
 }
 
+void destroy_gtimer(gtimer_t *timer) {
+  free(timer);
+}
+
 void start_gtimer(gtimer_t *timer) {
-  gettimeofday(&(timer->start), NULL);
+  timer->start = gtimer_now();
 }
 
 void stop_gtimer(gtimer_t *timer) {
-  gettimeofday(&(timer->finish), NULL);
+  timer->finish = gtimer_now();
 }
 
 double elapsed_seconds(gtimer_t *timer) {
-  double start = timer->start.tv_sec + (timer->start.tv_usec / 1000000.0);
-  double finish = timer->finish.tv_sec + (timer->finish.tv_usec / 1000000.0);
-  return(finish - start);
+  return(timer->finish - timer->start);
+}
+
+double gtimer_now() {
+#ifdef __APPLE__
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0)
+    mach_timebase_info(&timebase);
+  return(mach_absolute_time() * 1e-9 * timebase.numer / timebase.denom);
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return(now.tv_sec + now.tv_nsec / 1000000000.0);
+#endif
+}
+
+long gtimer_peak_memory() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return(0);
+#ifdef __APPLE__
+  /* Darwin reports the size in bytes. */
+  return(usage.ru_maxrss / 1024);
+#else
+  return(usage.ru_maxrss);
+#endif
 }
 
 
@@ -29,4 +62,3 @@ double elapsed_seconds(gtimer_t *timer) {
 #ifdef __cplusplus
 }
 #endif
-
@@ -5,22 +5,29 @@
 extern "C" {
 #endif
 
-#include <sys/time.h>
-
+/* The times are read from a monotonic clock, so they are not
+ * affected by changes of the system time. */
 typedef struct {
-  struct timeval start;
-  struct timeval finish;
+  double start;
+  double finish;
 } gtimer_t;
 
 gtimer_t *create_gtimer();
+void destroy_gtimer(gtimer_t *);
 void start_gtimer(gtimer_t *);
 void stop_gtimer(gtimer_t *);
 double elapsed_seconds(gtimer_t *);
 
+/* The current time of the monotonic clock in seconds from an
+ * arbitrary starting point. */
+double gtimer_now();
+
+/* The peak resident memory of the process in kilobytes. */
+long gtimer_peak_memory();
+
 
 #ifdef __cplusplus
 }
 #endif
 
 #endif
- 
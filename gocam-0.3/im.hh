@@ -2,6 +2,8 @@
 #define IM_HH
 
 #include <assert.h>
+#include <algorithm>
+#include <vector>
 #include "CImg.h"
 #include "util.hh"
 
@@ -17,9 +19,13 @@ namespace im {
     /** Initialize the summer with a reference to an image. */
     PixelSum(const CImg<T> &img) : img(img), sum(0), count(0) { }
 
-    /** Process a pixel by summing. */
+    /** Process a pixel by summing.  Pixels outside the image are
+     * ignored.
+     */
     void operator()(int x, int y)
     {
+      if (x < 0 || y < 0 || x >= (int)img.width || y >= (int)img.height)
+	return;
       sum += img(x, y);
       count++;
     }
@@ -64,6 +70,466 @@ namespace im {
 	img[i] = 0;
   }
 
+  /** Resize an image buffer for a one-channel image of the given
+   * size.  The old buffer is reused if the size does not change, and
+   * the contents are undefined otherwise.
+   */
+  template <typename T>
+  void
+  reuse_image(CImg<T> &img, int width, int height)
+  {
+    if ((int)img.width != width || (int)img.height != height ||
+	img.depth != 1 || img.dim != 1)
+      img = CImg<T>(width, height);
+  }
+
+  /** A pool of image buffers of different sizes.
+   *
+   * reuse() resizes an image like reuse_image(), but a buffer of
+   * another size is exchanged with a pooled buffer of the requested
+   * size, and the old buffer is kept in the pool.  Thus images that
+   * switch between a few sizes, such as the levels of a pyramid, are
+   * not reallocated once each size has been seen.  At most \c
+   * max_buffers buffers are kept; when the pool is full, the slots
+   * are overwritten in turn.
+   */
+  template <typename T>
+  struct ImagePool {
+
+    /** The maximum number of buffers in the pool. */
+    enum { max_buffers = 16 };
+
+    /** Create an empty pool. */
+    ImagePool() : next(0) { buffers.reserve(max_buffers); }
+
+    /** Resize a one-channel image, reusing the pooled buffers.  The
+     * contents are undefined if the size changes.
+     */
+    void reuse(CImg<T> &img, int width, int height)
+    {
+      if ((int)img.width == width && (int)img.height == height &&
+	  img.depth == 1 && img.dim == 1)
+	return;
+      for (int i = 0; i < (int)buffers.size(); i++) {
+	if ((int)buffers[i].width == width && 
+	    (int)buffers[i].height == height) {
+	  img.swap(buffers[i]);
+	  return;
+	}
+      }
+      release(img);
+      CImg<T>(width, height).swap(img);
+    }
+
+    /** Move the buffer of an image to the pool, leaving the image
+     * empty. 
+     */
+    void release(CImg<T> &img)
+    {
+      if (img.size() == 0 || img.depth != 1 || img.dim != 1) {
+	img.empty();
+	return;
+      }
+      for (int i = 0; i < (int)buffers.size(); i++) {
+	if (buffers[i].size() == 0) {
+	  img.swap(buffers[i]);
+	  return;
+	}
+      }
+      if ((int)buffers.size() < max_buffers) {
+	buffers.push_back(CImg<T>());
+	img.swap(buffers.back());
+	return;
+      }
+      buffers[next].empty();
+      img.swap(buffers[next]);
+      next = (next + 1) % max_buffers;
+    }
+
+    std::vector<CImg<T> > buffers; //!< The pooled buffers
+    int next; //!< The slot to overwrite next when the pool is full
+  };
+
+  /** Work buffers of the peak filters below.  Passing the same
+   * buffers to calls on images of the same size avoids allocating
+   * memory.
+   */
+  template <typename T>
+  struct FilterBuffers {
+    std::vector<double> column_sum; //!< The box sums of the columns
+    std::vector<T> x_weight; //!< The Gaussian weights of the columns
+    std::vector<T> y_weight; //!< The Gaussian weights of the rows
+  };
+
+  /** Correlate an image with the peak filter and pass the results to
+   * a function object.
+   *
+   * The result is the same as correlating with peak_filter(width,
+   * sign) with the borders extended (as CImg::get_correlate() does),
+   * but the filter is computed as \c width * \c width times the
+   * center pixel minus the box sum around it.  The box sums are
+   * computed with running sums, so the time does not depend on the
+   * width of the filter.
+   *
+   * \param src = the image to filter
+   * \param width = the width of the filter (odd)
+   * \param sign = the sign of the center of the filter
+   * \param func = the function object called as \c func(x, y, value)
+   * for each pixel in row-major order
+   * \param buffers = the work buffers (NULL = allocate temporary ones)
+   * \return a reference to \c func
+   */
+  template <typename T, typename F>
+  F&
+  peak_correlate_map(const CImg<T> &src, int width, int sign, F &func,
+		     FilterBuffers<T> *buffers = NULL)
+  {
+    assert(width % 2 == 1);
+    int w = src.width;
+    int h = src.height;
+    int r = width / 2;
+
+    // Keep the vertical box sums of the current row for each column,
+    // and slide the horizontal box sum over them.
+    FilterBuffers<T> local_buffers;
+    if (buffers == NULL)
+      buffers = &local_buffers;
+    std::vector<double> &column_sum = buffers->column_sum;
+    column_sum.assign(w, 0);
+    for (int y = -r; y <= r; y++) {
+      const T *row = src.ptr(0, cimg::max(0, cimg::min(h - 1, y)));
+      for (int x = 0; x < w; x++)
+	column_sum[x] += row[x];
+    }
+    for (int y = 0; y < h; y++) {
+      if (y > 0) {
+	const T *add = src.ptr(0, cimg::min(h - 1, y + r));
+	const T *sub = src.ptr(0, cimg::max(0, y - r - 1));
+	for (int x = 0; x < w; x++)
+	  column_sum[x] += add[x] - sub[x];
+      }
+      double box = 0;
+      for (int x = -r; x <= r; x++)
+	box += column_sum[cimg::max(0, cimg::min(w - 1, x))];
+      const T *center = src.ptr(0, y);
+      for (int x = 0; x < w; x++) {
+	if (x > 0)
+	  box += column_sum[cimg::min(w - 1, x + r)] -
+	    column_sum[cimg::max(0, x - r - 1)];
+	func(x, y, sign * ((double)width * width * center[x] - box));
+      }
+    }
+    return func;
+  }
+
+  /** A function object for peak_correlate_map() that stores the
+   * values in an image.
+   */
+  template <typename T>
+  struct PeakStore {
+
+    /** Initialize with the destination image. */
+    PeakStore(CImg<T> &dest) : dest(dest) { }
+
+    /** Store a value. */
+    void operator()(int x, int y, double value)
+    {
+      dest(x, y) = (T)value;
+    }
+
+    CImg<T> &dest; //!< The image to store the values to
+  };
+
+  /** A function object for peak_correlate_map() that stores the
+   * values in an image with negative values set to zero, and keeps
+   * track of the range of the stored values.  The columns outside
+   * the destination are skipped.
+   */
+  template <typename T>
+  struct PeakRange {
+
+    /** Initialize with the destination image, and the column of the
+     * source corresponding to the first column of \c dest. 
+     */
+    PeakRange(CImg<T> &dest, int x0 = 0) 
+      : dest(dest), x0(x0), min(0), max(0), first(true) { }
+
+    /** Store a value. */
+    void operator()(int x, int y, double value)
+    {
+      x -= x0;
+      if (x < 0 || x >= (int)dest.width)
+	return;
+      T v = value < 0 ? 0 : (T)value;
+      dest(x, y) = v;
+      if (first || v < min)
+	min = v;
+      if (first || v > max)
+	max = v;
+      first = false;
+    }
+
+    CImg<T> &dest; //!< The image to store the values to
+    int x0; //!< The column of the source at the first column of \c dest
+    double min; //!< The minimum of the stored values
+    double max; //!< The maximum of the stored values
+    bool first; //!< True before the first value
+  };
+
+  /** Correlate an image with the peak filter.
+   *
+   * \see peak_correlate_map()
+   * \param src = the image to filter
+   * \param width = the width of the filter (odd)
+   * \param sign = the sign of the center of the filter
+   * \param dest = the result (reused if it has the size of \c src)
+   * \param buffers = the work buffers (NULL = allocate temporary ones)
+   */
+  template <typename T>
+  void
+  peak_correlate(const CImg<T> &src, int width, int sign, CImg<T> &dest,
+		 FilterBuffers<T> *buffers = NULL)
+  {
+    assert(&src != &dest);
+    reuse_image(dest, src.width, src.height);
+    PeakStore<T> store(dest);
+    peak_correlate_map(src, width, sign, store, buffers);
+  }
+
+  /** Correlate an image with the peak filter, set negative values
+   * to zero, and normalize the result between 0 and 1.
+   *
+   * This is the same as correlating with peak_filter(), calling
+   * zero_negatives() and CImg::normalize(0, 1), but the filter is
+   * computed as in peak_correlate_map(), and the zeroing and finding
+   * the range for normalizing are done in the same pass.
+   *
+   * \param src = the image to filter
+   * \param width = the width of the filter (odd)
+   * \param sign = the sign of the center of the filter
+   * \param dest = the result (reused if it has the size of \c src)
+   * \param buffers = the work buffers (NULL = allocate temporary ones)
+   * \return a reference to \c dest
+   */
+  template <typename T>
+  CImg<T>&
+  peak_filter_correlate(const CImg<T> &src, int width, int sign,
+			CImg<T> &dest, FilterBuffers<T> *buffers = NULL)
+  {
+    assert(&src != &dest);
+    reuse_image(dest, src.width, src.height);
+    PeakRange<T> range(dest);
+    peak_correlate_map(src, width, sign, range, buffers);
+
+    if (range.min == range.max)
+      dest.fill(0);
+    else
+      for (int i = 0; i < (int)dest.size(); i++)
+	dest[i] = (T)((dest[i] - range.min) / (range.max - range.min));
+    return dest;
+  }
+
+  /** Compute the maximums of runs of pixels.
+   *
+   * \param src = the source image
+   * \param length = the length of the runs
+   * \param vertical = run downwards instead of to the right
+   * \param dest = the result: the maximum of \c length pixels of \c
+   * src starting from each pixel, or up to the edge of the image
+   * (reused if it has the size of \c src)
+   */
+  template <typename T>
+  void
+  run_max(const CImg<T> &src, int length, bool vertical, CImg<T> &dest)
+  {
+    assert(&src != &dest && length > 0);
+    int w = src.width;
+    int h = src.height;
+    reuse_image(dest, w, h);
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+	T max = src(x, y);
+	for (int i = 1; i < length; i++) {
+	  if (vertical ? y + i >= h : x + i >= w)
+	    break;
+	  T value = vertical ? src(x, y + i) : src(x + i, y);
+	  if (value > max)
+	    max = value;
+	}
+	dest(x, y) = max;
+      }
+    }
+  }
+
+  /** Scale an image down by an integer factor by averaging blocks of
+   * pixels.
+   *
+   * The pixel (x, y) of \c dest is the mean of the \c factor x \c
+   * factor block of \c src starting at (factor * x, factor * y), so
+   * its center is at (factor * x + (factor - 1) / 2, ...) in \c src.
+   * The incomplete blocks at the right and the bottom edge are
+   * dropped.
+   *
+   * \param src = the source image
+   * \param factor = the scaling factor (positive)
+   * \param dest = the result (reused if it has the size of the result)
+   * \param buffer = the buffer for the row sums (NULL = allocate a
+   * temporary one)
+   */
+  template <typename T>
+  void
+  downsample(const CImg<T> &src, int factor, CImg<T> &dest,
+	     std::vector<double> *buffer = NULL)
+  {
+    assert(&src != &dest && factor > 0);
+    int w = src.width / factor;
+    int h = src.height / factor;
+    reuse_image(dest, w, h);
+    std::vector<double> local_row;
+    std::vector<double> &row = buffer != NULL ? *buffer : local_row;
+    row.resize(w);
+    for (int y = 0; y < h; y++) {
+      std::fill(row.begin(), row.end(), 0);
+      for (int i = 0; i < factor; i++) {
+	const T *src_row = src.ptr(0, y * factor + i);
+	for (int x = 0; x < w; x++)
+	  for (int j = 0; j < factor; j++)
+	    row[x] += src_row[x * factor + j];
+      }
+      for (int x = 0; x < w; x++)
+	dest(x, y) = (T)(row[x] / (factor * factor));
+    }
+  }
+
+  /** Compute a table of Gaussian weights exp(-(c - i)^2 / (2 sigma2))
+   * for i = 0, 1, ..., size - 1.
+   *
+   * \param table = the table to fill
+   * \param size = the size of the table
+   * \param c = the center of the Gaussian
+   * \param sigma2 = the variance of the Gaussian (all weights are one
+   * if not positive)
+   */
+  template <typename T>
+  void
+  gaussian_table(std::vector<T> &table, int size, float c, float sigma2)
+  {
+    table.resize(size);
+    for (int i = 0; i < size; i++) {
+      float exponent = 0;
+      if (sigma2 > 0)
+	exponent = -0.5 * (c - i) * (c - i) / sigma2;
+      table[i] = exp(exponent);
+    }
+  }
+
+  /** A PeakRange that keeps track also of the maximum of the values
+   * weighted with a separable centered Gaussian.
+   */
+  template <typename T>
+  struct WeightedPeakRange : public PeakRange<T> {
+
+    /** Initialize with the destination image and the weight tables. */
+    WeightedPeakRange(CImg<T> &dest, const std::vector<T> &x_weight,
+		      const std::vector<T> &y_weight)
+      : PeakRange<T>(dest), x_weight(x_weight), y_weight(y_weight),
+	weighted_max(0) { }
+
+    /** Store a value. */
+    void operator()(int x, int y, double value)
+    {
+      PeakRange<T>::operator()(x, y, value);
+      double weighted = this->dest(x, y) * x_weight[x] * y_weight[y];
+      if (weighted > weighted_max)
+	weighted_max = weighted;
+    }
+
+    const std::vector<T> &x_weight; //!< The weights of the columns
+    const std::vector<T> &y_weight; //!< The weights of the rows
+    double weighted_max; //!< The maximum of the weighted values
+  };
+
+  /** Compute a line image and its version weighted with a centered
+   * Gaussian.
+   *
+   * The results are the same as
+   * \code
+   * dest = src.get_correlate(peak_filter<T>(width, sign));
+   * zero_negatives(dest);
+   * dest.normalize(0, 1);
+   * weighted_dest = dest;
+   * weight_gaussian(weighted_dest, xc, yc, x_sigma2, y_sigma2);
+   * weighted_dest.normalize(0, 1);
+   * \endcode
+   * but the Gaussian is tabulated separately for the columns and
+   * the rows, and both images are written in the same pass.  The
+   * range of the weighted image is known after the first pass, if
+   * the minimum of the line image is zero, as it always is in
+   * practice.  Otherwise, a third pass normalizes the weighted image.
+   *
+   * \param src = the image to filter
+   * \param width = the width of the peak filter (odd)
+   * \param sign = the sign of the center of the peak filter
+   * \param x_sigma2 = the variance of the Gaussian in x-dimension
+   * \param y_sigma2 = the variance of the Gaussian in y-dimension
+   * \param dest = the line image (reused if it has the size of \c src)
+   * \param weighted_dest = the weighted line image (reused if it has
+   * the size of \c src)
+   * \param buffers = the work buffers (NULL = allocate temporary ones)
+   */
+  template <typename T>
+  void
+  peak_filter_gaussian(const CImg<T> &src, int width, int sign,
+		       float x_sigma2, float y_sigma2,
+		       CImg<T> &dest, CImg<T> &weighted_dest,
+		       FilterBuffers<T> *buffers = NULL)
+  {
+    assert(&src != &dest && &src != &weighted_dest);
+    int w = src.width;
+    int h = src.height;
+    reuse_image(dest, w, h);
+    reuse_image(weighted_dest, w, h);
+    FilterBuffers<T> local_buffers;
+    if (buffers == NULL)
+      buffers = &local_buffers;
+    std::vector<T> &x_weight = buffers->x_weight;
+    std::vector<T> &y_weight = buffers->y_weight;
+    gaussian_table(x_weight, w, w / 2.0, x_sigma2);
+    gaussian_table(y_weight, h, h / 2.0, y_sigma2);
+
+    // Filter, zero the negatives, and find the ranges.
+    WeightedPeakRange<T> range(dest, x_weight, y_weight);
+    peak_correlate_map(src, width, sign, range, buffers);
+    if (range.min == range.max) {
+      dest.fill(0);
+      weighted_dest.fill(0);
+      return;
+    }
+
+    // Normalize both images.  If the minimum was zero, the maximum of
+    // the weighted values is the maximum of the weighted image before
+    // normalizing, and the minimum of the weighted image is zero.
+    double scale = 1 / (range.max - range.min);
+    double weighted_scale = 1;
+    if (range.min == 0)
+      weighted_scale = range.max / range.weighted_max;
+    double weighted_max = 0;
+    for (int y = 0; y < h; y++) {
+      T *line = dest.ptr(0, y);
+      T *weighted = weighted_dest.ptr(0, y);
+      for (int x = 0; x < w; x++) {
+	line[x] = (T)((line[x] - range.min) * scale);
+	weighted[x] = (T)(line[x] * x_weight[x] * y_weight[y] *
+			  weighted_scale);
+	if (weighted[x] > weighted_max)
+	  weighted_max = weighted[x];
+      }
+    }
+    if (range.min != 0 && weighted_max > 0)
+      for (int i = 0; i < (int)weighted_dest.size(); i++)
+	weighted_dest[i] = (T)(weighted_dest[i] / weighted_max);
+  }
+
   /** Weigh an image with a centered gaussian.
       \param img = the image to weight
       \param xc = center-x of the gaussian
@@ -86,6 +552,388 @@ namespace im {
     }
   }
 
+  /** Thin the curves of a binary image to the width of one pixel.
+   *
+   * The image is thinned with the Zhang-Suen algorithm: pixels are
+   * removed from the south-east and north-west boundaries of the
+   * curves in alternating sub-iterations, until nothing changes.
+   * The pixels at the edges of the image are cleared.
+   *
+   * \param img = the image to thin (0 = background, non-zero = curve)
+   * \return a reference to the thinned image
+   */
+  template <typename T>
+  CImg<T>&
+  thin(CImg<T> &img)
+  {
+    int w = img.width;
+    int h = img.height;
+    for (int x = 0; x < w; x++)
+      img(x, 0) = img(x, h - 1) = 0;
+    for (int y = 0; y < h; y++)
+      img(0, y) = img(w - 1, y) = 0;
+
+    std::vector<int> removed;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (int step = 0; step < 2; step++) {
+	removed.clear();
+	for (int y = 1; y < h - 1; y++) {
+	  for (int x = 1; x < w - 1; x++) {
+	    if (!img(x, y))
+	      continue;
+
+	    // The neighbours clockwise starting from north
+	    int p[8] = { img(x, y-1) != 0, img(x+1, y-1) != 0, 
+			 img(x+1, y) != 0, img(x+1, y+1) != 0,
+			 img(x, y+1) != 0, img(x-1, y+1) != 0, 
+			 img(x-1, y) != 0, img(x-1, y-1) != 0 };
+	    int neighbours = 0;
+	    int transitions = 0;
+	    for (int i = 0; i < 8; i++) {
+	      neighbours += p[i];
+	      transitions += (!p[i] && p[(i + 1) % 8]);
+	    }
+	    if (neighbours < 2 || neighbours > 6 || transitions != 1)
+	      continue;
+	    if (step == 0 && ((p[0] && p[2] && p[4]) || (p[2] && p[4] && p[6])))
+	      continue;
+	    if (step == 1 && ((p[0] && p[2] && p[6]) || (p[0] && p[4] && p[6])))
+	      continue;
+	    removed.push_back(y * w + x);
+	  }
+	}
+	for (int i = 0; i < (int)removed.size(); i++)
+	  img[removed[i]] = 0;
+	if (!removed.empty())
+	  changed = true;
+      }
+    }
+    return img;
+  }
+
+  /** Precomputed state for voting pixels into a Hough accumulator.
+   *
+   * The positive pixels of the source image are collected once into
+   * a list of coordinates relative to the center of the image, and
+   * the cosines and sines of the thetas are tabulated.  The rho of a
+   * pixel for theta \f$t\f$ is then simply \f$x \cos t + y \sin
+   * t\f$, and no trigonometric functions are needed while voting.
+   *
+   * The pixels closer than \c max_rho - 1 to the center can never
+   * vote outside the accumulator, so they are stored first and
+   * voted without any range checks.  The rest of the pixels follow
+   * them in the list.
+   *
+   * The accumulator used by vote() is stored theta-major: each theta
+   * has a contiguous column of column_size() values, i.e., it is a
+   * CImg of width column_size() and height \c num_thetas.  The pixels are
+   * processed in blocks, and each block votes for all thetas before
+   * the next block is started.  This way both the block and the
+   * column being updated stay in the cache, and the computation of
+   * the rhos of a block is a plain loop that the compiler can
+   * vectorize.
+   */
+  template <typename T>
+  struct HoughVoter {
+
+    /** The number of pixels processed at a time in vote(). */
+    enum { block_size = 64 };
+
+    /** Create an empty voter to be set with assign(). */
+    HoughVoter()
+      : num_thetas(0), num_rhos(1), rho_center(0), num_inner(0), 
+	num_pixels(0) { }
+
+    /** Create a voter.
+     * \param src = the image to transform
+     * \param theta1 = the smallest value of theta (in degrees)
+     * \param theta2 = the largest value of theta (in degrees)
+     * \param num_thetas = the number of thetas
+     * \param max_rho = the maximum distance considered
+     */
+    HoughVoter(const CImg<T> &src, float theta1, float theta2, 
+	       int num_thetas, int max_rho)
+    {
+      assign(src, theta1, theta2, num_thetas, max_rho);
+    }
+
+    /** Set up the voter as the constructor does.  The tables keep
+     * their memory, so a voter reused for images of the same size
+     * does not allocate.
+     */
+    void assign(const CImg<T> &src, float theta1, float theta2, 
+		int num_thetas, int max_rho)
+    {
+      this->num_thetas = num_thetas;
+      num_rhos = max_rho * 2 + 1;
+      rho_center = num_rhos / 2;
+      num_inner = 0;
+      num_pixels = 0;
+      cos_table.resize(num_thetas);
+      sin_table.resize(num_thetas);
+      px.clear();
+      py.clear();
+      value.clear();
+      int capacity = src.size() + 2 * block_size;
+      px.reserve(capacity);
+      py.reserve(capacity);
+      value.reserve(capacity);
+      float theta_delta = 0;
+      if (num_thetas > 1)
+	theta_delta = (theta2 - theta1) / (num_thetas - 1);
+      for (int t = 0; t < num_thetas; t++) {
+	double theta = (theta1 + t * theta_delta) / 180 * M_PI;
+	cos_table[t] = std::cos(theta);
+	sin_table[t] = std::sin(theta);
+      }
+
+      // Collect the inner pixels on the first pass and the outer
+      // pixels on the second pass.
+      int center_x = (int)src.width / 2;
+      int center_y = (int)src.height / 2;
+      int inner_dist2 = util::sqr(util::max(max_rho - 1, 0));
+      for (int pass = 0; pass < 2; pass++) {
+	cimg_mapXY(src, x, y) {
+	  if (src(x,y) <= 0)
+	    continue;
+	  int dx = x - center_x;
+	  int dy = y - center_y;
+	  if ((dx * dx + dy * dy <= inner_dist2) != (pass == 0))
+	    continue;
+	  px.push_back(dx);
+	  py.push_back(dy);
+	  value.push_back(src(x,y));
+	  num_pixels++;
+	}
+	// Pad the pixels of the pass to full blocks with empty pixels
+	// at the center, so that every block has exactly block_size
+	// pixels.
+	while (value.size() % block_size != 0) {
+	  px.push_back(0);
+	  py.push_back(0);
+	  value.push_back(0);
+	}
+	if (pass == 0)
+	  num_inner = value.size();
+      }
+    }
+
+    /** The number of pixels to vote (a multiple of \c block_size). */
+    int size() const { return value.size(); }
+
+    /** The number of values in one accumulator column.  The column
+     * has one extra value after the last rho, which absorbs the
+     * votes falling over the edge, so that the voting loop does not
+     * need to check it.
+     */
+    int column_size() const { return num_rhos + 1; }
+
+    /** Vote a range of pixels into a theta-major accumulator.
+     * \param p1 = the first pixel to vote
+     * \param p2 = the pixel after the last pixel to vote
+     * \param t1 = the first theta to vote for
+     * \param t2 = the last theta to vote for
+     * \param acc = the accumulator: (t2 - t1 + 1) columns of
+     * column_size() values
+     */
+    void vote(int p1, int p2, int t1, int t2, T *acc) const
+    {
+      assert(p1 % block_size == 0 && p2 % block_size == 0);
+      for (int b = p1; b < p2; b += block_size)
+	vote_block(b, t1, t2, acc, b >= num_inner);
+    }
+
+    /** Copy a theta-major accumulator to the columns of a Hough image.
+     * \param acc = the accumulator filled by vote()
+     * \param t1 = the first theta of the accumulator
+     * \param t2 = the last theta of the accumulator
+     * \param result = the Hough image (\c num_thetas x \c num_rhos)
+     */
+    void store(const T *acc, int t1, int t2, CImg<T> &result) const
+    {
+      const int stride = column_size();
+      for (int r = 0; r < num_rhos; r++)
+	for (int t = t1; t <= t2; t++)
+	  result(t, r) = acc[(t - t1) * stride + r];
+    }
+
+    int num_thetas; //!< The number of thetas
+    int num_rhos; //!< The number of rhos (2 * max_rho + 1)
+    int rho_center; //!< The rho index of lines crossing the center
+    int num_inner; //!< The number of pixels that need no range checks
+    int num_pixels; //!< The number of positive pixels without padding
+    std::vector<float> cos_table; //!< Cosine of each theta
+    std::vector<float> sin_table; //!< Sine of each theta
+    std::vector<float> px; //!< The x-coordinates of the positive pixels
+    std::vector<float> py; //!< The y-coordinates of the positive pixels
+    std::vector<T> value; //!< The values of the positive pixels
+
+  private:
+
+    /** Vote a block of \c block_size pixels for a range of thetas.
+     * \param b = the first pixel of the block
+     * \param t1 = the first theta to vote for
+     * \param t2 = the last theta to vote for
+     * \param acc = the accumulator
+     * \param check = should the rhos be checked against the range
+     */
+    void vote_block(int b, int t1, int t2, T *acc, bool check) const
+    {
+      const int stride = column_size();
+      const float *bx = &px[b];
+      const float *by = &py[b];
+      const T *bv = &value[b];
+      float r[block_size];
+
+      for (int t = t1; t <= t2; t++) {
+	const float c = cos_table[t];
+	const float s = sin_table[t];
+	T *column = acc + (t - t1) * stride;
+
+	for (int i = 0; i < block_size; i++)
+	  r[i] = bx[i] * c + by[i] * s + rho_center;
+
+	// Split the vote between the two nearest rhos.
+	if (check) {
+	  for (int i = 0; i < block_size; i++) {
+	    if (r[i] < 0 || r[i] >= num_rhos)
+	      continue;
+	    int ir = (int)r[i];
+	    float w = r[i] - ir;
+	    column[ir] += bv[i] * (1 - w);
+	    column[ir + 1] += bv[i] * w;
+	  }
+	}
+	else {
+	  for (int i = 0; i < block_size; i++) {
+	    int ir = (int)r[i];
+	    float w = r[i] - ir;
+	    column[ir] += bv[i] * (1 - w);
+	    column[ir + 1] += bv[i] * w;
+	  }
+	}
+      }
+    }
+  };
+
+  /** Votes ranges of pixels into private accumulators in parallel.
+   *
+   * This is the function object used by hough() to run HoughVoter in
+   * several threads.  Thread \c i votes the \c i'th contiguous range
+   * of pixel blocks into \c acc[i].
+   */
+  template <typename T>
+  struct HoughThreadVoter {
+
+    /** Create the voter.
+     * \param voter = the voter shared by all threads
+     * \param acc = the accumulators of the threads
+     */
+    HoughThreadVoter(const HoughVoter<T> &voter, std::vector<CImg<T> > &acc)
+      : voter(voter), acc(acc) { }
+
+    /** Vote the pixels of the \c i'th thread. */
+    void operator()(int i)
+    {
+      int num_blocks = voter.size() / HoughVoter<T>::block_size;
+      int p1 = (long)num_blocks * i / acc.size() * HoughVoter<T>::block_size;
+      int p2 = (long)num_blocks * (i + 1) / acc.size() * 
+	HoughVoter<T>::block_size;
+      acc[i].fill(0);
+      voter.vote(p1, p2, 0, voter.num_thetas - 1, acc[i].ptr());
+    }
+
+    const HoughVoter<T> &voter; //!< The voter shared by all threads
+    std::vector<CImg<T> > &acc; //!< The accumulators of the threads
+  };
+
+  /** Sums pairs of accumulators for a tree reduction.
+   *
+   * At each level of the reduction, the call with index \c i adds
+   * \c acc[2 * i * step + step] to \c acc[2 * i * step].  The pairs
+   * are fixed by the number of accumulators only, so the result does
+   * not depend on the timing of the threads.
+   */
+  template <typename T>
+  struct AccumulatorReducer {
+
+    /** Create a reducer for one level of the reduction.
+     * \param acc = the accumulators
+     * \param step = the distance of the summed accumulators
+     */
+    AccumulatorReducer(std::vector<CImg<T> > &acc, int step)
+      : acc(acc), step(step) { }
+
+    /** Sum the \c i'th pair. */
+    void operator()(int i)
+    {
+      int tgt = 2 * i * step;
+      int src = tgt + step;
+      if (src < (int)acc.size())
+	acc[tgt] += acc[src];
+    }
+
+    std::vector<CImg<T> > &acc; //!< The accumulators
+    int step; //!< The distance of the summed accumulators
+  };
+
+  /** The voter and the accumulators of hough() that can be kept over
+   * calls.
+   */
+  template <typename T>
+  struct HoughBuffers {
+    HoughBuffers() : threads(NULL) { }
+
+    HoughVoter<T> voter; //!< The pixels and the tables of the transform
+    std::vector<CImg<T> > acc; //!< The accumulators of the threads
+
+    /** The threads that vote, or NULL to create threads for each
+     * call. 
+     */
+    util::ThreadPool *threads;
+  };
+
+  /** Compute the Hough transform to a given image as hough() below
+   * does.
+   *
+   * When the same buffers are used for images of the same size, and
+   * the result has the right size already, no memory is allocated
+   * with one thread.
+   *
+   * \param result = the Hough transform of \c src
+   * \param buffers = the work buffers
+   */
+  template<typename T>
+  void hough(const CImg<T> &src, float theta1, float theta2, 
+	     int num_thetas, int max_rho, CImg<T> &result, 
+	     HoughBuffers<T> &buffers, int num_threads = 1,
+	     int *num_pixels = NULL)
+  {
+    HoughVoter<T> &voter = buffers.voter;
+    voter.assign(src, theta1, theta2, num_thetas, max_rho);
+    if (num_pixels != NULL)
+      *num_pixels = voter.num_pixels;
+    std::vector<CImg<T> > &acc = buffers.acc;
+    acc.resize(util::max(num_threads, 1));
+    for (int i = 0; i < (int)acc.size(); i++)
+      reuse_image(acc[i], voter.column_size(), num_thetas);
+
+    util::ThreadPool local_threads;
+    util::ThreadPool &threads = 
+      buffers.threads != NULL ? *buffers.threads : local_threads;
+    HoughThreadVoter<T> thread_voter(voter, acc);
+    threads.run(acc.size(), thread_voter);
+    for (int step = 1; step < (int)acc.size(); step *= 2) {
+      AccumulatorReducer<T> reducer(acc, step);
+      threads.run((acc.size() + 2 * step - 1) / (2 * step), reducer);
+    }
+
+    reuse_image(result, num_thetas, voter.num_rhos);
+    voter.store(acc[0].ptr(), 0, num_thetas - 1, result);
+  }
+
   /** 
       Compute the Hough transform.
 
@@ -97,58 +945,117 @@ namespace im {
       the result will be (2 * \c max_rho + 1).  The center row of the
       Hough image corresponds to lines crossing the center of the
       original image.
+
+      Each positive pixel votes for every theta, and the vote is split
+      bilinearly between the two nearest rhos.  See HoughVoter for
+      the details of the voting.
+
+      With several threads, the pixels are split into contiguous
+      ranges, each thread votes its range into a private accumulator,
+      and the accumulators are summed pairwise in a tree.  The sums
+      are always formed in the same order, so the result is exactly
+      reproducible for a fixed number of threads.  Different numbers
+      of threads may differ in the last bits of the floats.
   
       \param src = the image to transform
       \param theta1 = the smallest value of theta
       \param theta2 = the largest value of theta 
       \param num_thetas = the width of the resulting image
       \param max_rho = the maximum distance considered
+      \param num_threads = the number of threads to use (default 1)
+      \param num_pixels = if given, set to the number of pixels voted
       \return Hough transform of \c src
   */
   template<typename T>
   CImg<T> hough(const CImg<T> &src, float theta1, float theta2, 
-		int num_thetas, int max_rho)
+		int num_thetas, int max_rho, int num_threads = 1,
+		int *num_pixels = NULL)
   {
-    int num_rhos = max_rho * 2 + 1;
-    int rho_center = num_rhos / 2;
-  
-    CImg<T> result = CImg<T>(num_thetas, num_rhos);
-    result.fill(0);
-
-    cimg_mapXY(src, x, y) {
+    CImg<T> result;
+    HoughBuffers<T> buffers;
+    hough(src, theta1, theta2, num_thetas, max_rho, result, buffers,
+	  num_threads, num_pixels);
+    return result;
+  }
 
-      // Skip non-positive pixels
-      if (src(x,y) <= 0)
-	continue;
+  /** A view of a Hough image of degrees 0, 1, ..., 179 as degrees 0,
+   * 1, ..., 359.
+   *
+   * The line at theta + 180 is the line at theta with the opposite
+   * rho, so the column theta + 180 is the column theta upside down.
+   * The view reads the flipped columns from the stored half, and the
+   * columns wrap around, so that the column -1 is the column 359.
+   */
+  template <typename T>
+  struct HoughView {
 
-      float rho_x = (float)x - src.width/2;
-      float rho_y = (float)y - src.height/2;
-      float rho0 = std::sqrt(rho_x * rho_x + rho_y * rho_y);
-      float theta0 = std::atan2(rho_y, rho_x) / M_PI * 180;
+    /** Create a view of a Hough image of degrees 0, 1, ..., 179.  The
+     * image must outlive the view.
+     */
+    explicit HoughView(const CImg<T> &half) 
+      : half(half), width(2 * half.width), height(half.height) { }
 
-      if (theta0 < 0) {
-	theta0 += 180;
-	rho0 = - rho0;
-      }
+    /** Access a pixel.
+     * \param x = the theta (any integer, wraps around)
+     * \param y = the rho
+     */
+    T operator()(int x, int y) const
+    {
+      x %= width;
+      if (x < 0)
+	x += width;
+      if (x < (int)half.width)
+	return half(x, y);
+      return half(x - half.width, height - 1 - y);
+    }
 
-      // Iterate all thetas and compute corresponding rho
-      float theta_delta = (theta2 - theta1) / (num_thetas - 1);
-      for (int t = 0; t < num_thetas; t++) {
-	float theta = theta1 + t * theta_delta;
-	float r = rho0 * std::cos((theta0 - theta) / 180 * M_PI) + rho_center;
-	if (r < 0 || r >= result.dimy())
-	  continue;
+    const CImg<T> &half; //!< The stored degrees 0, 1, ..., 179
+    int width; //!< The number of thetas in the view (360)
+    int height; //!< The number of rhos
+  };
 
-	int ir = (int)floor(r);
-	float w = r - ir;
+  /** Correlate a Hough image of degrees 0, 1, ..., 179 with the peak
+   * filter, set negative values to zero, and normalize the result
+   * between 0 and 1.
+   *
+   * The result is the same as computing peak_filter_correlate() of
+   * the full 360 degrees of HoughView and keeping the first 180
+   * columns, except that the columns wrap around at degrees 0 and
+   * 360 instead of being extended.  Only the first half and \c width
+   * / 2 flipped columns on each side are filtered.
+   *
+   * \param src = the Hough image of degrees 0, 1, ..., 179
+   * \param width = the width of the filter (odd)
+   * \param sign = the sign of the center of the filter
+   * \param padded = a buffer for \c src with the wrapped columns
+   * \param dest = the result (reused if it has the size of \c src)
+   * \param buffers = the work buffers (NULL = allocate temporary ones)
+   */
+  template <typename T>
+  void
+  peak_filter_hough(const CImg<T> &src, int width, int sign, 
+		    CImg<T> &padded, CImg<T> &dest, 
+		    FilterBuffers<T> *buffers = NULL)
+  {
+    assert(&src != &dest && &src != &padded);
+    int w = src.width;
+    int h = src.height;
+    int pad = width / 2;
+    HoughView<T> view(src);
+    reuse_image(padded, w + 2 * pad, h);
+    for (int y = 0; y < h; y++)
+      for (int x = -pad; x < w + pad; x++)
+	padded(x + pad, y) = view(x, y);
 
-	result(t, ir) += src(x, y) * (1 - w);
-	if (ir + 1 < (int)result.height)
-	  result(t, ir+1) += src(x, y) * w;
-      }
-    }
+    reuse_image(dest, w, h);
+    PeakRange<T> range(dest, pad);
+    peak_correlate_map(padded, width, sign, range, buffers);
 
-    return result;
+    if (range.min == range.max)
+      dest.fill(0);
+    else
+      for (int i = 0; i < (int)dest.size(); i++)
+	dest[i] = (T)((dest[i] - range.min) / (range.max - range.min));
   }
 
 
@@ -160,20 +1067,24 @@ namespace im {
    * \param img = the source image
    * \param x1 = the start of the range
    * \param x2 = the end of the range
+   * \param buffer = the buffer for the values (NULL = allocate a
+   * temporary one)
    */
   template <typename T>
   T
-  median(CImg<T> &img, int x1, int x2)
+  median(CImg<T> &img, int x1, int x2, std::vector<T> *buffer = NULL)
   {
     if (x1 < 0)
       x1 = 0;
     if (x2 >= (int)img.width)
       x2 = img.width - 1;
 
-    std::vector<T> values(x2 - x1 + 1);
+    std::vector<T> local_values;
+    std::vector<T> &values = buffer != NULL ? *buffer : local_values;
+    values.resize(x2 - x1 + 1);
     for (int x = x1; x <= x2; x++)
       values[x - x1] = img(x);
-    return util::median(values);
+    return util::median_in_place(values);
   }
 
 
@@ -183,13 +1094,16 @@ namespace im {
    * \param x0 = the location of the peak
    * \param win = the width of the median analysis window
    * \param value = the value to set the peak neighbourhood to
+   * \param buffer = the buffer for median() (NULL = allocate a
+   * temporary one)
    */
   template <typename T>
   void
-  median_peak_remove(CImg<T> &img, int x0, int win, T value = 0)
+  median_peak_remove(CImg<T> &img, int x0, int win, T value = 0,
+		     std::vector<T> *buffer = NULL)
   {
     // Compute the threshold to stop the removing
-    T threshold = im::median(img, x0 - win, x0 + win);
+    T threshold = im::median(img, x0 - win, x0 + win, buffer);
 
     // Remove values in the right neighbourhood
     for (int i = 0; i < win; i++) {
@@ -267,6 +1181,30 @@ namespace im {
     return best_x;
   }
 
+  /** Find maximum along a row of a Hough image viewed as 360 degrees.
+   * \see find_max_x()
+   */
+  template <typename T>
+  int
+  find_max_x(const HoughView<T> &img, int y, int x1 = 0, int x2 = -1)
+  {
+    if (x2 < 0)
+      x2 = img.width - 1;
+
+    int best_x = x1;
+    T best = img(best_x, y);
+
+    while (x1 < x2) {
+      x1++;
+      if (img(x1, y) > best) {
+	best = img(x1, y);
+	best_x = x1;
+      }
+    }
+  
+    return best_x;
+  }
+
   /** Paste an image to another image.
    * \param src = the image to be pasted
    * \param tgt = the target images
@@ -288,21 +1226,112 @@ namespace im {
 
   /** Compute the sum of each column of the image.
    * \param img = the source image
-   * \return a one-dimensional image containing the sum of each column
+   * \param result = the one-dimensional image of the sums of the
+   * columns (reused if it has the right size)
    */
   template<typename T>
-  CImg<T> sum_y(const CImg<T> &img)
+  void sum_y(const CImg<T> &img, CImg<T> &result)
   {
-    CImg<T> result(img.width, 1);
+    reuse_image(result, img.width, 1);
     for (int x = 0; x < (int)img.width; x++) {
       T sum = 0;
       for (int y = 0; y < (int)img.height; y++)
 	sum += img(x,y);
       result(x) = sum;
     }
+  }
+
+  /** Compute the sum of each column of a Hough image viewed as 360
+   * degrees.  The flipped columns have the same sums, so only the
+   * stored half is summed.
+   * \param img = the source view
+   * \param result = the one-dimensional image of the 360 sums
+   * (reused if it has the right size)
+   */
+  template<typename T>
+  void sum_y(const HoughView<T> &img, CImg<T> &result)
+  {
+    int w = img.half.width;
+    reuse_image(result, img.width, 1);
+    for (int x = 0; x < w; x++) {
+      T sum = 0;
+      for (int y = 0; y < img.height; y++)
+	sum += img.half(x, y);
+      result(x) = sum;
+      result(x + w) = sum;
+    }
+  }
+
+  /** Compute the sum of each column of the image.
+   * \param img = the source image
+   * \return a one-dimensional image containing the sum of each column
+   */
+  template<typename T>
+  CImg<T> sum_y(const CImg<T> &img)
+  {
+    CImg<T> result;
+    sum_y(img, result);
     return result;
   }
 
+  /** Sum the pixels in a horizontal window around each pixel.
+   *
+   * The result is the same as get_correlate() with a row of 2 * \c
+   * radius + 1 ones: the borders are extended, and the window is
+   * summed from left to right in double precision.
+   *
+   * \param src = the source image
+   * \param radius = the number of pixels on each side of the center
+   * \param dest = the result (reused if it has the size of \c src)
+   */
+  template<typename T>
+  void box_filter_x(const CImg<T> &src, int radius, CImg<T> &dest)
+  {
+    assert(&src != &dest);
+    int w = src.width;
+    reuse_image(dest, w, src.height);
+    for (int y = 0; y < (int)src.height; y++) {
+      const T *row = src.ptr(0, y);
+      T *dest_row = dest.ptr(0, y);
+      for (int x = 0; x < w; x++) {
+	double sum = 0;
+	for (int i = -radius; i <= radius; i++)
+	  sum += row[util::max(0, util::min(w - 1, x + i))];
+	dest_row[x] = (T)sum;
+      }
+    }
+  }
+
+  /** Sum the pixels of a Hough image viewed as 360 degrees in a
+   * horizontal window around each pixel.
+   *
+   * The result is again the stored half of a view: the windows wrap
+   * around the 360 degrees instead of extending the borders, so the
+   * sums of the flipped columns are the flipped sums of the stored
+   * columns.
+   *
+   * \param src = the source view
+   * \param radius = the number of pixels on each side of the center
+   * \param dest = the sums of degrees 0, 1, ..., 179 (reused if it
+   * has the size of the stored half)
+   */
+  template<typename T>
+  void box_filter_x(const HoughView<T> &src, int radius, CImg<T> &dest)
+  {
+    assert(&src.half != &dest);
+    int w = src.half.width;
+    reuse_image(dest, w, src.height);
+    for (int y = 0; y < src.height; y++) {
+      T *dest_row = dest.ptr(0, y);
+      for (int x = 0; x < w; x++) {
+	double sum = 0;
+	for (int i = -radius; i <= radius; i++)
+	  sum += src(x + i, y);
+	dest_row[x] = (T)sum;
+      }
+    }
+  }
+
   /** Set range of values in an one-dimensional image.
    *
    * \note It is safe to specify ranges outside the image.  The range
@@ -336,13 +1365,14 @@ namespace im {
    * \param img = the source image
    * \param x1 = the start of the range
    * \param x2 = the end of the range (negative: use width of image)
-   * \return a one dimensional row image containing the maximums
+   * \param result = the one dimensional row image of the maximums
+   * (reused if it has the right size)
    */
   template <typename T>
-  CImg<T>
-  max_x(const CImg<T> &img, int x1 = 0, int x2 = -1)
+  void
+  max_x(const CImg<T> &img, int x1, int x2, CImg<T> &result)
   {
-    CImg<T> result(img.height);
+    reuse_image(result, img.height, 1);
   
     if (x2 < 0)
       x2 = img.width - 1;
@@ -355,7 +1385,47 @@ namespace im {
       }
       result(y) = max;
     }
+  }
 
+  /** Compute the maximum of each row of a Hough image viewed as 360
+   * degrees.  The range may wrap around the view.
+   *
+   * \param img = the source view
+   * \param x1 = the start of the range
+   * \param x2 = the end of the range
+   * \param result = the one dimensional row image of the maximums
+   * (reused if it has the right size)
+   */
+  template <typename T>
+  void
+  max_x(const HoughView<T> &img, int x1, int x2, CImg<T> &result)
+  {
+    reuse_image(result, img.height, 1);
+    for (int y = 0; y < img.height; y++) {
+      T max = img(x1, y);
+      for (int x = x1 + 1; x <= x2; x++) {
+	if (img(x, y) > max)
+	  max = img(x, y);
+      }
+      result(y) = max;
+    }
+  }
+
+  /** Compute the maximum of each row.
+   *
+   * \warning The validity of the range is not checked.
+   * 
+   * \param img = the source image
+   * \param x1 = the start of the range
+   * \param x2 = the end of the range (negative: use width of image)
+   * \return a one dimensional row image containing the maximums
+   */
+  template <typename T>
+  CImg<T>
+  max_x(const CImg<T> &img, int x1 = 0, int x2 = -1)
+  {
+    CImg<T> result;
+    max_x(img, x1, x2, result);
     return result;
   }
 
@@ -363,21 +1433,23 @@ namespace im {
    *
    * \bug The float coordinates should be handled more elegantly so
    * that the line is processed along the longer axis and the other
-   * coordinate is computed for each middle location.
+   * coordinate is computed for each middle location.  See
+   * line_sum_subpixel().
+   *
+   * Pixels outside the image are counted as zero.
    *
-   * \warning Does not check the image boundaries.
    * \param img = the source image
    * \param line = the line to sum
    * \return The sum of the pixel values along the line.
    */
   template <typename T>
   T
-  line_sum(CImg<T> &img, const geom::Line &line)
+  line_sum(const CImg<T> &img, const geom::Line &line)
   {
     // Check single point
     if ((int)(line.a.x + 0.5) == (int)(line.b.x + 0.5) &&
 	(int)(line.a.y + 0.5) == (int)(line.b.y + 0.5))
-      return img((int)(line.a.x + 0.5), (int)(line.b.y + 0.5));
+      return img.dirichlet_pix2d((int)(line.a.x + 0.5), (int)(line.b.y + 0.5));
 
     // Compute line
     float dx = line.b.x - line.a.x;
@@ -391,12 +1463,325 @@ namespace im {
     for (int i = 0; i <= div; i++) {
       int x = (int)(line.a.x + i * dx + 0.5);
       int y = (int)(line.a.y + i * dy + 0.5);
+      if (x < 0 || y < 0 || x >= (int)img.width || y >= (int)img.height)
+	continue;
       result += img(x, y);
     }
 
     return result;
   }
 
+  /** Compute the sum of an image along a line with sub-pixel
+   * accuracy.
+   *
+   * The line is sampled at each pixel center of the longer axis
+   * between the end points.  The other coordinate is advanced
+   * incrementally, and the image is interpolated linearly between the
+   * two nearest pixels (as in Wu's line algorithm).  Thus moving an
+   * end point by a fraction of a pixel changes the sum smoothly.
+   *
+   * Pixels outside the image are counted as zero.
+   *
+   * \param img = the source image
+   * \param line = the line to sum
+   * \return the weighted sum of the pixel values along the line
+   */
+  template <typename T>
+  T
+  line_sum_subpixel(const CImg<T> &img, const geom::Line &line)
+  {
+    // Process the line along the major axis u.  Step along u moves
+    // u_stride and step along v v_stride pixels in the buffer.
+    bool steep = 
+      cimg::abs(line.b.y - line.a.y) > cimg::abs(line.b.x - line.a.x);
+    float u1 = steep ? line.a.y : line.a.x;
+    float v1 = steep ? line.a.x : line.a.y;
+    float u2 = steep ? line.b.y : line.b.x;
+    float v2 = steep ? line.b.x : line.b.y;
+    if (u2 < u1) {
+      std::swap(u1, u2);
+      std::swap(v1, v2);
+    }
+    int nu = steep ? img.height : img.width;
+    int nv = steep ? img.width : img.height;
+    int u_stride = steep ? img.width : 1;
+    int v_stride = steep ? 1 : img.width;
+
+    int first = util::max((int)std::ceil(u1), 0);
+    int last = util::min((int)std::floor(u2), nu - 1);
+    if (first > last)
+      return 0;
+    double slope = (u2 > u1) ? (v2 - v1) / (u2 - u1) : 0;
+    double v = v1 + (first - u1) * slope;
+    double v_last = v + (last - first) * slope;
+    const T *data = img.ptr();
+    T result = 0;
+
+    // Inside the image the two pixels need no checks.  The margin
+    // covers the rounding errors of advancing v.
+    if (util::min(v, v_last) >= 0.001 && 
+	util::max(v, v_last) < nv - 1.001) {
+      for (int u = first; u <= last; u++, v += slope) {
+	int v0 = (int)v;
+	float w = v - v0;
+	const T *pix = data + u * u_stride + v0 * v_stride;
+	result += pix[0] + w * (pix[v_stride] - pix[0]);
+      }
+      return result;
+    }
+
+    for (int u = first; u <= last; u++, v += slope) {
+      int v0 = (int)std::floor(v);
+      float w = v - v0;
+      const T *pix = data + u * u_stride;
+      if (v0 >= 0 && v0 < nv)
+	result += (1 - w) * pix[v0 * v_stride];
+      if (v0 + 1 >= 0 && v0 + 1 < nv)
+	result += w * pix[(v0 + 1) * v_stride];
+    }
+    return result;
+  }
+
+  /** The coordinate of step \c i of a line as computed in
+   * line_sum().
+   */
+  inline int
+  line_coord(float a, int i, float d)
+  {
+    return (int)(a + i * d + 0.5);
+  }
+
+  /** Check if map_line_runs() passes the pixels of a line one at a
+   * time.
+   */
+  inline bool
+  short_line_runs(const geom::Line &line)
+  {
+    float dx = cimg::abs(line.b.x - line.a.x);
+    float dy = cimg::abs(line.b.y - line.a.y);
+    return cimg::min(dx, dy) / cimg::max(dx, dy) > 0.25;
+  }
+
+  /** Find the runs of pixels that line_sum() visits.
+   *
+   * The pixels of a line form runs of constant y (or constant x for
+   * steep lines).  \c func(vertical, v, u1, u2) is called for each
+   * run: the pixels u1..u2 (u1 <= u2) of the row v, or of the column
+   * v if \c vertical is true.  The runs are clipped to the image.
+   *
+   * Finding the end of a run costs a few pixels, so lines steeper
+   * than 1:4 from the axes are passed one pixel at a time.
+   *
+   * \param line = the line
+   * \param width = the width of the image
+   * \param height = the height of the image
+   * \param func = the function to call for each run
+   */
+  template <typename F>
+  void
+  map_line_runs(const geom::Line &line, int width, int height, F &func)
+  {
+    // Check single point
+    if ((int)(line.a.x + 0.5) == (int)(line.b.x + 0.5) &&
+	(int)(line.a.y + 0.5) == (int)(line.b.y + 0.5)) {
+      int x = (int)(line.a.x + 0.5);
+      int y = (int)(line.b.y + 0.5);
+      if (x >= 0 && y >= 0 && x < width && y < height)
+	func(false, y, x, x);
+      return;
+    }
+
+    float dx = line.b.x - line.a.x;
+    float dy = line.b.y - line.a.y;
+    float div = cimg::max(cimg::abs(dx), cimg::abs(dy));
+    dx /= div;
+    dy /= div;
+
+    // Process the line along the major axis u.  The coordinates are
+    // computed exactly as in line_sum().
+    bool steep = cimg::abs(dy) > cimg::abs(dx);
+    float au = steep ? line.a.y : line.a.x;
+    float av = steep ? line.a.x : line.a.y;
+    float du = steep ? dy : dx;
+    float dv = steep ? dx : dy;
+    int nu = steep ? height : width;
+    int nv = steep ? width : height;
+    int last = (int)div;
+
+    if (short_line_runs(line)) {
+      for (int i = 0; i <= last; i++) {
+	int x = line_coord(line.a.x, i, dx);
+	int y = line_coord(line.a.y, i, dy);
+	if (x >= 0 && y >= 0 && x < width && y < height)
+	  func(false, y, x, x);
+      }
+      return;
+    }
+
+    double inv_dv = dv != 0 ? 1.0 / dv : 0;
+    for (int i = 0; i <= last; ) {
+
+      // Find the last step j of the run with the same v.  The
+      // coordinates are monotonic, so the estimate is corrected by
+      // stepping.
+      int v = line_coord(av, i, dv);
+      int j = last;
+      if (dv != 0) {
+	double edge = (dv > 0 ? v + 0.5 : v - 0.5) - av;
+	double estimate = std::floor(edge * inv_dv);
+	j = (int)util::max((double)i, util::min((double)last, estimate));
+	while (j < last && line_coord(av, j + 1, dv) == v)
+	  j++;
+	while (j > i && line_coord(av, j, dv) != v)
+	  j--;
+      }
+
+      // The u-coordinates of a run are consecutive, except for the
+      // rounding near zero in line_sum().  Such runs are passed pixel
+      // by pixel.
+      int u1 = line_coord(au, i, du);
+      int u2 = line_coord(au, j, du);
+      if (cimg::abs(u2 - u1) != j - i) {
+	for (int k = i; k <= j; k++) {
+	  int u = line_coord(au, k, du);
+	  if (u >= 0 && v >= 0 && u < nu && v < nv)
+	    func(steep, v, u, u);
+	}
+      }
+      else if (v >= 0 && v < nv) {
+	int first = util::max(util::min(u1, u2), 0);
+	int end = util::min(util::max(u1, u2), nu - 1);
+	if (first <= end)
+	  func(steep, v, first, end);
+      }
+      i = j + 1;
+    }
+  }
+
+  /** Precomputed sums for summing pixels along lines.
+   *
+   * The pixels visited by line_sum() form runs of constant y (or
+   * constant x for steep lines).  With the running sums of the rows
+   * and the columns, each run is summed with two lookups, so a line
+   * costs one step per row (column) it crosses instead of one per
+   * pixel.  The grid lines are close to the image axes, so they
+   * consist of a few long runs.  The runs are found with
+   * map_line_runs().
+   *
+   * The lines visit exactly the same pixels as with line_sum().  The
+   * sums are computed in double precision, so they may differ from
+   * line_sum() by its rounding errors.
+   */
+  template <typename T>
+  struct LineSums {
+
+    /** Create empty sums. */
+    LineSums() : img(NULL) { }
+
+    /** Compute the sums of an image.  The image must not change or be
+     * destroyed while the sums are used.  The buffers are reused if
+     * the size of the image does not change, or taken from \c pool
+     * if it is given.
+     */
+    void assign(const CImg<T> &src, ImagePool<double> *pool = NULL)
+    {
+      img = &src;
+      int width = src.width;
+      int height = src.height;
+      if (pool != NULL) {
+	pool->reuse(row_sums, width + 1, height);
+	pool->reuse(column_sums, width, height + 1);
+      }
+      if ((int)row_sums.width != width + 1 || (int)row_sums.height != height)
+	row_sums = CImg<double>(width + 1, height);
+      if ((int)column_sums.width != width || 
+	  (int)column_sums.height != height + 1)
+	column_sums = CImg<double>(width, height + 1);
+
+      for (int y = 0; y < height; y++) {
+	const T *src_row = src.ptr(0, y);
+	double *row = row_sums.ptr(0, y);
+	row[0] = 0;
+	for (int x = 0; x < width; x++)
+	  row[x + 1] = row[x] + src_row[x];
+      }
+      double *column = column_sums.ptr(0, 0);
+      for (int x = 0; x < width; x++)
+	column[x] = 0;
+      for (int y = 0; y < height; y++) {
+	const T *src_row = src.ptr(0, y);
+	const double *prev = column_sums.ptr(0, y);
+	double *next = column_sums.ptr(0, y + 1);
+	for (int x = 0; x < width; x++)
+	  next[x] = prev[x] + src_row[x];
+      }
+    }
+
+    /** Check if the sums have been computed for an image at its
+     * current size.
+     */
+    bool matches(const CImg<T> &src) const
+    {
+      return img == &src && (int)row_sums.width == (int)src.width + 1 &&
+	row_sums.height == src.height;
+    }
+
+    /** Compute the sum of the pixels along a line as line_sum().
+     *
+     * \param line = the line to sum
+     * \param count = if given, set to the number of pixels summed
+     * inside the image
+     * \return the sum of the pixel values along the line
+     */
+    double operator()(const geom::Line &line, int *count = NULL) const
+    {
+      if (count == NULL && short_line_runs(line))
+	return line_sum(*img, line);
+      RunSum run_sum(*this);
+      map_line_runs(line, img->width, img->height, run_sum);
+      if (count != NULL)
+	*count = run_sum.count;
+      return run_sum.sum;
+    }
+
+    /** The sum of the pixels u1..u2 of the row v, or of the column v
+     * if \c vertical is true.
+     */
+    double run(bool vertical, int v, int u1, int u2) const
+    {
+      if (u1 == u2)
+	return vertical ? (*img)(v, u1) : (*img)(u1, v);
+      if (vertical)
+	return column_sums(v, u2 + 1) - column_sums(v, u1);
+      return row_sums(u2 + 1, v) - row_sums(u1, v);
+    }
+
+    /** Sums the runs of a line for operator(). */
+    struct RunSum {
+      RunSum(const LineSums &sums) : sums(sums), sum(0), count(0) { }
+      void operator()(bool vertical, int v, int u1, int u2)
+      {
+	sum += sums.run(vertical, v, u1, u2);
+	count += u2 - u1 + 1;
+      }
+      const LineSums &sums; //!< The sums of the image
+      double sum; //!< The sum of the runs
+      int count; //!< The number of pixels in the runs
+    };
+
+    const CImg<T> *img; //!< The image of the sums
+
+    /** The running sums of the rows: the pixel (x, y) is the sum of
+     * the pixels 0..x-1 of the row y.
+     */
+    CImg<double> row_sums;
+
+    /** The running sums of the columns: the pixel (x, y) is the sum
+     * of the pixels 0..y-1 of the column x.
+     */
+    CImg<double> column_sums;
+  };
+
 };
 
 #endif /* IM_HH */
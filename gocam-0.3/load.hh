@@ -0,0 +1,210 @@
+#ifndef LOAD_HH
+#define LOAD_HH
+
+#include <csetjmp>
+#include <cstdio>
+#include <vector>
+#include "CImg.h"
+#include "im.hh"
+#include "jpeglib.h"
+#include "png.h"
+
+using namespace cimg_library;
+
+/** General image processing tools. */
+namespace im {
+
+  /** An error manager for libjpeg that returns to the caller instead
+   * of exiting the program.
+   */
+  struct JpegError {
+    jpeg_error_mgr mgr; //!< The libjpeg error manager (must be first)
+    std::jmp_buf jump; //!< The state to return to on errors
+  };
+
+  /** The error_exit handler of JpegError. */
+  inline void
+  jpeg_error_exit(j_common_ptr info)
+  {
+    std::longjmp(((JpegError*)info->err)->jump, 1);
+  }
+
+  /** Load a JPEG image as a gray-scale image.
+   *
+   * The gray-scale image is the red channel of a color image.  This
+   * is what Analyser::reset() gets by resizing a color image to one
+   * channel, and the analysis parameters have been tuned for it.  The
+   * pixel values are between 0 and 255.
+   *
+   * If \c min_width is given, large images are scaled down by 1/2,
+   * 1/4 or 1/8 while decoding, as long as the result is at least \c
+   * min_width pixels wide.  libjpeg scales in the DCT domain, so the
+   * full-size image is never decoded.
+   *
+   * \param file = the file to read from the beginning
+   * \param img = the image to load to
+   * \param min_width = the minimum width of a scaled-down image (0 =
+   * do not scale)
+   * \param scale = if given, set to the ratio of the original width
+   * to the width of \c img
+   * \return false if the file could not be decoded
+   */
+  inline bool
+  load_jpeg_gray(std::FILE *file, CImg<float> &img, int min_width = 0,
+		 float *scale = NULL)
+  {
+    jpeg_decompress_struct info;
+    JpegError error;
+
+    info.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(error.jump)) {
+      jpeg_destroy_decompress(&info);
+      return false;
+    }
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+    if (info.jpeg_color_space != JCS_GRAYSCALE)
+      info.out_color_space = JCS_RGB;
+    info.scale_num = 1;
+    info.scale_denom = 1;
+    if (min_width > 0) {
+      while (info.scale_denom < 8 &&
+	     ((int)info.image_width + 2 * (int)info.scale_denom - 1) / 
+	     (2 * (int)info.scale_denom) >= min_width)
+	info.scale_denom *= 2;
+    }
+    jpeg_start_decompress(&info);
+    if (scale != NULL)
+      *scale = (float)info.image_width / info.output_width;
+
+    int width = info.output_width;
+    int channels = info.output_components;
+    reuse_image(img, width, info.output_height);
+
+    // The row buffer is taken from the memory pool of the decoder,
+    // which is freed with the decoder, instead of the C++ heap.
+    JSAMPARRAY row = (*info.mem->alloc_sarray)
+      ((j_common_ptr)&info, JPOOL_IMAGE, width * channels, 1);
+    while (info.output_scanline < info.output_height) {
+      float *dst = img.ptr(0, info.output_scanline);
+      jpeg_read_scanlines(&info, row, 1);
+      for (int x = 0; x < width; x++)
+	dst[x] = row[0][x * channels];
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+  }
+
+  /** Load a PNG image as a gray-scale image.
+   *
+   * The gray-scale image is the red channel of a color image as in
+   * load_jpeg_gray(), and the alpha channel is ignored.  The pixel
+   * values are between 0 and 255.  PNG images are never scaled.
+   *
+   * \param file = the file to read from the beginning
+   * \param img = the image to load to
+   * \return false if the file could not be decoded
+   */
+  inline bool
+  load_png_gray(std::FILE *file, CImg<float> &img)
+  {
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+					     NULL, NULL, NULL);
+    if (png == NULL)
+      return false;
+    png_infop info = png_create_info_struct(png);
+    if (info == NULL) {
+      png_destroy_read_struct(&png, NULL, NULL);
+      return false;
+    }
+    std::vector<png_byte> rows;
+    std::vector<png_bytep> row_pointers;
+    if (setjmp(png_jmpbuf(png))) {
+      png_destroy_read_struct(&png, &info, NULL);
+      return false;
+    }
+
+    png_init_io(png, file);
+    png_read_info(png, info);
+    int color_type = png_get_color_type(png, info);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+    png_set_packing(png);
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+      png_set_palette_to_rgb(png);
+    if (color_type == PNG_COLOR_TYPE_GRAY)
+      png_set_expand_gray_1_2_4_to_8(png);
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    int width = png_get_image_width(png, info);
+    int height = png_get_image_height(png, info);
+    int channels = png_get_channels(png, info);
+    reuse_image(img, width, height);
+
+    // Interlaced images are decoded in several passes over the whole
+    // image, so all rows are kept until the last pass.
+    int row_bytes = png_get_rowbytes(png, info);
+    rows.resize(height * row_bytes);
+    row_pointers.resize(height);
+    for (int y = 0; y < height; y++)
+      row_pointers[y] = &rows[y * row_bytes];
+    for (int pass = 0; pass < passes; pass++)
+      png_read_rows(png, &row_pointers[0], NULL, height);
+    for (int y = 0; y < height; y++) {
+      float *dst = img.ptr(0, y);
+      for (int x = 0; x < width; x++)
+	dst[x] = row_pointers[y][x * channels];
+    }
+
+    png_read_end(png, NULL);
+    png_destroy_read_struct(&png, &info, NULL);
+    return true;
+  }
+
+  /** Load a JPEG or PNG image as a gray-scale image without
+   * converting it through a temporary file.
+   *
+   * The format is detected from the contents of the file.  The
+   * buffer of \c img is reused if the size of the image does not
+   * change.
+   *
+   * \param filename = the file to load
+   * \param img = the image to load to
+   * \param min_width = the minimum width of a JPEG image scaled down
+   * while decoding (see load_jpeg_gray(), 0 = do not scale)
+   * \param scale = if given, set to the ratio of the original width
+   * to the width of \c img
+   * \return false if the file is not a JPEG or PNG image, or it could
+   * not be decoded
+   */
+  inline bool
+  load_gray(const char *filename, CImg<float> &img, int min_width = 0,
+	    float *scale = NULL)
+  {
+    std::FILE *file = std::fopen(filename, "rb");
+    if (file == NULL)
+      return false;
+
+    unsigned char magic[8];
+    bool ok = false;
+    if (scale != NULL)
+      *scale = 1;
+    if (std::fread(magic, 1, 8, file) == 8) {
+      std::rewind(file);
+      if (magic[0] == 0xff && magic[1] == 0xd8)
+	ok = load_jpeg_gray(file, img, min_width, scale);
+      else if (png_sig_cmp(magic, 0, 8) == 0)
+	ok = load_png_gray(file, img);
+    }
+    std::fclose(file);
+    return ok;
+  }
+
+};
+
+#endif /* LOAD_HH */
@@ -0,0 +1,83 @@
+#ifndef TEST_HH
+#define TEST_HH
+
+#include <cstdarg>
+#include <cstdio>
+#include "gocam.hh"
+#include "load.hh"
+
+/** Helpers of the test programs run by "make check".
+ *
+ * Each test program takes the sample images as its arguments, prints
+ * a line for each failed check, and returns a non-zero exit status
+ * if any check failed.
+ */
+namespace test {
+
+  /** The number of failed checks. */
+  static int failures = 0;
+
+  /** Report a failed check if \c ok is false.
+   * \return \c ok
+   */
+  inline bool
+  check(bool ok, const char *format, ...)
+  {
+    if (!ok) {
+      std::va_list args;
+      va_start(args, format);
+      std::fprintf(stderr, "FAIL: ");
+      std::vfprintf(stderr, format, args);
+      std::fprintf(stderr, "\n");
+      va_end(args);
+      failures++;
+    }
+    return ok;
+  }
+
+  /** Load an image as gocam_analyse() does, JPEG images scaled down
+   * to at least \c width pixels (0 = do not scale).
+   */
+  inline void
+  load(const char *filename, CImg<float> &img, int width = 0)
+  {
+    float scale;
+    if (!im::load_gray(filename, img, width, &scale))
+      CImg<float>(filename).swap(img);
+    img.normalize(0, 1);
+  }
+
+  /** Compute the thinned binary image of the line image of an image,
+   * as voted by Analyser::compute_kht_hough_image().
+   */
+  inline void
+  features(const CImg<float> &img, CImg<unsigned char> &binary)
+  {
+    gocam::Analyser analyser;
+    analyser.verbose = 0;
+    analyser.reset(img);
+    analyser.compute_line_images();
+    const CImg<float> &line_image = analyser.line_image;
+    binary = CImg<unsigned char>(line_image.width, line_image.height);
+    cimg_mapXY(line_image, x, y)
+      binary(x, y) = line_image(x, y) > analyser.kht_threshold;
+    im::thin(binary);
+  }
+
+  /** Print the result of a test program.
+   * \return the exit status of the program
+   */
+  inline int
+  finish(const char *name)
+  {
+    if (failures > 0) {
+      std::fprintf(stderr, "%s: %d checks failed\n", name, failures);
+      return 1;
+    }
+    std::printf("%s: ok\n", name);
+    return 0;
+  }
+
+}
+
+#endif /* TEST_HH */
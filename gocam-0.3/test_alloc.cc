@@ -0,0 +1,62 @@
+#include <cstdlib>
+#include <new>
+#include "test.hh"
+#include "gocam_test.h"
+
+/** The number of calls to operator new since the program started. */
+static long allocations = 0;
+
+void *
+operator new(std::size_t size)
+{
+  allocations++;
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *
+operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void
+operator delete(void *p)
+{
+  std::free(p);
+}
+
+void
+operator delete[](void *p)
+{
+  std::free(p);
+}
+
+/** The width the images are decoded at.  The photos take minutes at
+ * full resolution.
+ */
+static const int analysis_width = 640;
+
+/** Analyse each sample image twice with the same context.  The
+ * second analysis must find the buffers of the first one, and not
+ * allocate with operator new at all.
+ */
+int
+main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++) {
+    gocam_context_t *context = gocam_create("/tmp");
+    gocam_set_analysis_width(context, analysis_width);
+    int result[8];
+    test::check(gocam_analyse(context, argv[i], result) == 0,
+		"%s: analysis failed", argv[i]);
+    long before = allocations;
+    gocam_analyse(context, argv[i], result);
+    test::check(allocations == before, "%s: the second analysis "
+		"allocated %ld times", argv[i], allocations - before);
+    gocam_destroy(context);
+  }
+  return test::finish("test_alloc");
+}
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <pthread.h>
+#include <vector>
+#include "test.hh"
+#include "gocam_test.h"
+
+/** The number of threads analysing the images concurrently. */
+static const int num_threads = 3;
+
+/** The width the images are decoded at, to keep the test short. */
+static const int analysis_width = 400;
+
+/** The images and the corners found for them by a single context. */
+static int num_images;
+static char **images;
+static std::vector<int> expected;
+
+/** The work of one thread: the index of the first image and the
+ * number of images with other corners than the serial run.
+ */
+struct Worker {
+  int first;
+  int mismatches;
+  int errors;
+};
+
+/** Analyse all images with a context of its own, starting at image
+ * \c first, and compare the corners to the serial run.
+ */
+static void *
+run_worker(void *arg)
+{
+  Worker &worker = *(Worker*)arg;
+  gocam_context_t *context = gocam_create("/tmp");
+  if (context == NULL) {
+    worker.errors = num_images;
+    return NULL;
+  }
+  gocam_set_analysis_width(context, analysis_width);
+  for (int n = 0; n < num_images; n++) {
+    int i = (worker.first + n) % num_images;
+    int result[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    if (gocam_analyse(context, images[i], result) != 0)
+      worker.errors++;
+    else if (!std::equal(result, result + 8, &expected[i * 8]))
+      worker.mismatches++;
+  }
+  gocam_destroy(context);
+  return NULL;
+}
+
+/** Check the profile of the last call with a context: the total
+ * time must cover the time of loading the image.
+ */
+static void
+check_profile(gocam_context_t *context, const char *name, const char *call)
+{
+  gocam_profile_t profile;
+  gocam_get_profile(context, &profile);
+  test::check(profile.load > 0 && profile.total >= profile.load,
+	      "%s: %s reported total %g and load %g", name, call, 
+	      profile.total, profile.load);
+}
+
+/** Analyse the sample images with one context, then with several
+ * contexts in concurrent threads, and require the same corners.
+ * Also check the profile of the analysis of the first image, and of
+ * tracking its grid in a 1x1 frame, which fails after loading it.
+ */
+int
+main(int argc, char **argv)
+{
+  num_images = argc - 1;
+  images = argv + 1;
+  expected.resize(num_images * 8);
+
+  gocam_context_t *context = gocam_create("/tmp");
+  gocam_set_analysis_width(context, analysis_width);
+  for (int i = 0; i < num_images; i++)
+    test::check(gocam_analyse(context, images[i], &expected[i * 8]) == 0,
+		"%s: analysis failed", images[i]);
+  if (num_images > 0) {
+    int result[8];
+    float strength;
+    const char *small = "/tmp/test_contexts_1x1.pgm";
+    gocam_analyse(context, images[0], result);
+    check_profile(context, images[0], "gocam_analyse()");
+    FILE *file = std::fopen(small, "w");
+    std::fprintf(file, "P2\n1 1\n255\n0\n");
+    std::fclose(file);
+    test::check(gocam_track(context, small, result, &strength) == -1,
+		"%s: tracking a 1x1 frame did not fail", images[0]);
+    check_profile(context, images[0], "a failed gocam_track()");
+    std::remove(small);
+  }
+  gocam_destroy(context);
+
+  Worker workers[num_threads];
+  pthread_t threads[num_threads];
+  for (int t = 0; t < num_threads; t++) {
+    workers[t].first = t * num_images / num_threads;
+    workers[t].mismatches = 0;
+    workers[t].errors = 0;
+    pthread_create(&threads[t], NULL, run_worker, &workers[t]);
+  }
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+    test::check(workers[t].errors == 0, "thread %d: %d analyses failed",
+		t, workers[t].errors);
+    test::check(workers[t].mismatches == 0,
+		"thread %d: %d images differ from one context", t,
+		workers[t].mismatches);
+  }
+  return test::finish("test_contexts");
+}
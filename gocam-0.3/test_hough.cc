@@ -0,0 +1,136 @@
+#include <cmath>
+#include "test.hh"
+
+/** The width the images are decoded at.  The reference transform
+ * takes minutes on the photos at full resolution.
+ */
+static const int analysis_width = 640;
+
+/** The original im::hough(), kept as the reference of the table-driven
+ * and blocked HoughVoter.
+ */
+template<typename T>
+CImg<T> reference_hough(const CImg<T> &src, float theta1, float theta2,
+			int num_thetas, int max_rho)
+{
+  int num_rhos = max_rho * 2 + 1;
+  int rho_center = num_rhos / 2;
+
+  CImg<T> result = CImg<T>(num_thetas, num_rhos);
+  result.fill(0);
+
+  cimg_mapXY(src, x, y) {
+
+    // Skip non-positive pixels
+    if (src(x,y) <= 0)
+      continue;
+
+    float rho_x = (float)x - src.width/2;
+    float rho_y = (float)y - src.height/2;
+    float rho0 = std::sqrt(rho_x * rho_x + rho_y * rho_y);
+    float theta0 = std::atan2(rho_y, rho_x) / M_PI * 180;
+
+    if (theta0 < 0) {
+      theta0 += 180;
+      rho0 = - rho0;
+    }
+
+    // Iterate all thetas and compute corresponding rho
+    float theta_delta = (theta2 - theta1) / (num_thetas - 1);
+    for (int t = 0; t < num_thetas; t++) {
+      float theta = theta1 + t * theta_delta;
+      float r = rho0 * std::cos((theta0 - theta) / 180 * M_PI) + rho_center;
+      if (r < 0 || r >= result.dimy())
+	continue;
+
+      int ir = (int)floor(r);
+      float w = r - ir;
+
+      result(t, ir) += src(x, y) * (1 - w);
+      if (ir + 1 < (int)result.height)
+	result(t, ir+1) += src(x, y) * w;
+    }
+  }
+
+  return result;
+}
+
+/** The largest absolute difference of two Hough images of the same
+ * size.  The first rho is left out: a vote falling on its lower edge
+ * is kept or dropped depending on the rounding of the rho.
+ */
+static float
+max_difference(const CImg<float> &a, const CImg<float> &b)
+{
+  float diff = 0;
+  for (int y = 1; y < (int)a.height; y++)
+    for (int x = 0; x < (int)a.width; x++)
+      diff = util::max(diff, std::fabs(a(x, y) - b(x, y)));
+  return diff;
+}
+
+/** Compare im::hough() to the reference bin for bin on the weighted
+ * line images of the sample images, for the full range of thetas and
+ * for a window as used by the orientation tracking.  The rhos are
+ * computed differently, so the bins must agree to 0.1% of the largest
+ * bin.  Then compare the transform with several threads to the
+ * serial one.
+ */
+int
+main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++) {
+    CImg<float> img;
+    test::load(argv[i], img, analysis_width);
+    gocam::Analyser analyser;
+    analyser.verbose = 0;
+    analyser.reset(img);
+    analyser.compute_line_images();
+    const CImg<float> &src = analyser.weighted_line_image;
+    int max_rho = cimg::max(src.height, src.width) / 2;
+
+    const int windows[2][3] = { { 0, 179, 180 }, { 75, 105, 31 } };
+    for (int w = 0; w < 2; w++) {
+      float theta1 = windows[w][0];
+      float theta2 = windows[w][1];
+      int num_thetas = windows[w][2];
+      CImg<float> reference =
+	reference_hough(src, theta1, theta2, num_thetas, max_rho);
+      CImg<float> result =
+	im::hough(src, theta1, theta2, num_thetas, max_rho);
+      if (!test::check(result.width == reference.width &&
+		       result.height == reference.height,
+		       "%s: hough image %dx%d, expected %dx%d", argv[i],
+		       result.width, result.height,
+		       reference.width, reference.height))
+	continue;
+      float diff = max_difference(result, reference);
+      double largest = CImgStats(reference, false).max;
+      test::check(diff <= 0.001 * largest,
+		  "%s: thetas %g-%g differ by %g (largest bin %g)", argv[i],
+		  theta1, theta2, diff, largest);
+    }
+
+    // Vote with several threads of a pool twice.  The threads sum
+    // their accumulators in a fixed order, so the calls agree
+    // exactly, and they differ from one thread in the last bits only.
+    util::ThreadPool threads;
+    im::HoughBuffers<float> buffers;
+    buffers.threads = &threads;
+    CImg<float> serial = im::hough(src, 0, 179, 180, max_rho);
+    double largest = CImgStats(serial, false).max;
+    for (int num_threads = 2; num_threads <= 5; num_threads += 3) {
+      CImg<float> first, second;
+      im::hough(src, 0, 179, 180, max_rho, first, buffers, num_threads);
+      im::hough(src, 0, 179, 180, max_rho, second, buffers, num_threads);
+      test::check(max_difference(first, second) == 0,
+		  "%s: %d threads do not repeat the result", argv[i], 
+		  num_threads);
+      float diff = max_difference(first, serial);
+      test::check(diff <= 1e-5 * largest,
+		  "%s: %d threads differ from one thread by %g", argv[i],
+		  num_threads, diff);
+    }
+  }
+  return test::finish("test_hough");
+}
@@ -0,0 +1,215 @@
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <vector>
+#include "test.hh"
+
+/** The width the images are decoded at. */
+static const int analysis_width = 640;
+
+/** The number of threads calling kht() concurrently. */
+static const int num_threads = 4;
+
+/** The number of times each thread transforms each image. */
+static const int rounds = 10;
+
+/** A binary image of feature pixels, as voted by
+ * Analyser::compute_kht_hough_image().
+ */
+struct Features {
+  int width;
+  int height;
+  std::vector<unsigned char> pixels;
+};
+
+/** The feature images of the sample images and their serial lines. */
+static std::vector<Features> features;
+static std::vector<std::vector<line_t> > expected;
+
+/** Compute the features of the line image of an image. */
+static void
+compute_features(const CImg<float> &img, Features &result)
+{
+  CImg<unsigned char> binary;
+  test::features(img, binary);
+  result.width = binary.width;
+  result.height = binary.height;
+  result.pixels.assign(binary.ptr(), binary.ptr() + binary.size());
+}
+
+/** Detect the lines of a feature image with a context.  kht()
+ * destroys its input, so a copy is transformed.
+ */
+static void
+detect(kht_context_t &context, const Features &input,
+       std::vector<line_t> &result)
+{
+  std::vector<unsigned char> pixels = input.pixels;
+  lines_list_t lines;
+  kht(context, lines, &pixels[0], input.width, input.height);
+  result.assign(lines.items(), lines.items() + lines.size());
+}
+
+/** The largest difference of the bins of the accumulators of two
+ * contexts.
+ */
+static int
+max_difference(const kht_context_t &a, const kht_context_t &b)
+{
+  const accumulator_t &acc_a = a.accumulator;
+  const accumulator_t &acc_b = b.accumulator;
+  int diff = 0;
+  for (size_t t = 1; t <= acc_a.height(); t++) {
+    const int *row_a = acc_a.bins() + t * acc_a.stride();
+    const int *row_b = acc_b.bins() + t * acc_b.stride();
+    for (size_t r = 1; r <= acc_a.width(); r++)
+      diff = util::max(diff, std::abs(row_a[r] - row_b[r]));
+  }
+  return diff;
+}
+
+/** Return true if two lists of lines are the same. */
+static bool
+same_lines(const std::vector<line_t> &a, const std::vector<line_t> &b)
+{
+  return a.size() == b.size() &&
+    (a.empty() || std::memcmp(&a[0], &b[0], a.size() * sizeof(line_t)) == 0);
+}
+
+/** Return true if \c lines are the first lines of \c all. */
+static bool
+is_prefix(const std::vector<line_t> &lines, const std::vector<line_t> &all)
+{
+  return lines.size() <= all.size() &&
+    (lines.empty() ||
+     std::memcmp(&lines[0], &all[0], lines.size() * sizeof(line_t)) == 0);
+}
+
+/** Detect the lines of a feature image with the peaks limited by \c
+ * max_lines and \c min_votes_fraction, and require the first lines
+ * of the full sweep.  With a fraction near zero, all peaks are kept,
+ * so the lines must be the whole full sweep.
+ */
+static void
+check_top_lines(const char *name, const Features &input,
+		const std::vector<line_t> &all)
+{
+  const int limits[] = { 1, 5, 40, 60 };
+  for (int k = 0; k < 4; k++) {
+    kht_context_t context;
+    context.max_lines = limits[k];
+    std::vector<line_t> lines;
+    detect(context, input, lines);
+    size_t size = util::min((size_t)limits[k], all.size());
+    test::check(lines.size() == size && is_prefix(lines, all),
+		"%s: %d lines are not the first %d of the full sweep", name,
+		(int)lines.size(), (int)size);
+  }
+
+  const double fractions[] = { 1e-9, 0.1, 0.3, 0.6 };
+  size_t previous_size = all.size();
+  for (int f = 0; f < 4; f++) {
+    kht_context_t context;
+    context.min_votes_fraction = fractions[f];
+    std::vector<line_t> lines;
+    detect(context, input, lines);
+    test::check(!lines.empty() && lines.size() <= previous_size &&
+		is_prefix(lines, all), "%s: the %d lines above %g are not "
+		"the first ones of the full sweep", name, (int)lines.size(),
+		fractions[f]);
+    if (f == 0)
+      test::check(lines.size() == all.size(), "%s: %d lines above %g, "
+		  "%d in the full sweep", name, (int)lines.size(),
+		  fractions[f], (int)all.size());
+    previous_size = lines.size();
+
+    context.max_lines = 5;
+    std::vector<line_t> limited;
+    detect(context, input, limited);
+    test::check(limited.size() == util::min(lines.size(), (size_t)5) &&
+		is_prefix(limited, lines), "%s: the first 5 lines above %g "
+		"are not the first ones without a limit", name, fractions[f]);
+  }
+}
+
+/** The work of one thread: its number and the number of results
+ * that differ from the serial ones.
+ */
+struct Worker {
+  int index;
+  int mismatches;
+};
+
+/** Transform all images \ref rounds times with a context of its own,
+ * starting at a different image in each thread.  Every other thread
+ * votes with two threads of its context.
+ */
+static void *
+run_worker(void *arg)
+{
+  Worker &worker = *(Worker*)arg;
+  kht_context_t context;
+  context.n_threads = 1 + worker.index % 2;
+  int n = features.size();
+  for (int r = 0; r < rounds; r++) {
+    for (int k = 0; k < n; k++) {
+      int i = (worker.index + k) % n;
+      std::vector<line_t> lines;
+      detect(context, features[i], lines);
+      if (!same_lines(lines, expected[i]))
+	worker.mismatches++;
+    }
+  }
+  return NULL;
+}
+
+/** Detect the lines of the sample images with kht() in a fresh
+ * context each, and then with contexts reused in concurrent threads,
+ * and require the same lines.  Also vote with the Gaussian kernels
+ * evaluated incrementally, which may change a bin by one, and detect
+ * only the strongest peaks (see check_top_lines()).
+ */
+int
+main(int argc, char **argv)
+{
+  features.resize(argc - 1);
+  expected.resize(argc - 1);
+  for (int i = 1; i < argc; i++) {
+    CImg<float> img;
+    test::load(argv[i], img, analysis_width);
+    compute_features(img, features[i - 1]);
+    kht_context_t context;
+    detect(context, features[i - 1], expected[i - 1]);
+    test::check(!expected[i - 1].empty(), "%s: no lines", argv[i]);
+    check_top_lines(argv[i], features[i - 1], expected[i - 1]);
+
+    kht_context_t incremental;
+    incremental.incremental_votes = true;
+    std::vector<line_t> lines;
+    detect(incremental, features[i - 1], lines);
+    if (test::check(incremental.accumulator.width() ==
+		    context.accumulator.width() &&
+		    incremental.accumulator.height() ==
+		    context.accumulator.height(),
+		    "%s: the accumulators differ in size", argv[i])) {
+      int diff = max_difference(context, incremental);
+      test::check(diff <= 1, "%s: incremental votes differ by %d",
+		  argv[i], diff);
+    }
+  }
+
+  Worker workers[num_threads];
+  pthread_t threads[num_threads];
+  for (int t = 0; t < num_threads; t++) {
+    workers[t].index = t;
+    workers[t].mismatches = 0;
+    pthread_create(&threads[t], NULL, run_worker, &workers[t]);
+  }
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+    test::check(workers[t].mismatches == 0,
+		"thread %d: %d results differ from the serial ones", t,
+		workers[t].mismatches);
+  }
+  return test::finish("test_kht");
+}
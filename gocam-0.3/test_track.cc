@@ -0,0 +1,73 @@
+#include <cmath>
+#include "test.hh"
+
+/** The width the images are decoded at.  The photos take minutes at
+ * full resolution.
+ */
+static const int analysis_width = 640;
+
+/** Return true if two line series are the same. */
+static bool
+same_lines(const std::vector<geom::Line> &a,
+	   const std::vector<geom::Line> &b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (int l = 0; l < (int)a.size(); l++)
+    if (a[l].a.x != b[l].a.x || a[l].a.y != b[l].a.y ||
+	a[l].b.x != b[l].b.x || a[l].b.y != b[l].b.y)
+      return false;
+  return true;
+}
+
+/** Track the grid of each sample image in the same image, in a frame
+ * too small for the grid, and in the same image again, which must
+ * still find the grid.  Then reduce the grid to a single line in each
+ * direction, which can not be tuned: tune_grid() and track() must
+ * leave it as it is, and track() must reject it.
+ */
+int
+main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++) {
+    CImg<float> img;
+    test::load(argv[i], img, analysis_width);
+    gocam::Analyser analyser;
+    analyser.verbose = 0;
+    analyser.reset(img);
+    analyser.analyse();
+    if (!test::check(analyser.tracked_strength > 0,
+		     "%s: no complete grid to track", argv[i]))
+      continue;
+
+    float strength = analyser.track(img);
+    test::check(strength > 0.9, "%s: tracking the same image gave "
+		"strength %g", argv[i], strength);
+    CImg<float> small(1, 1, 1, 1, 0);
+    strength = analyser.track(small);
+    test::check(strength == 0, "%s: tracking a 1x1 frame gave strength %g",
+		argv[i], strength);
+    strength = analyser.track(img);
+    test::check(strength > 0.9, "%s: tracking after a rejected frame gave "
+		"strength %g", argv[i], strength);
+
+    for (int s = 0; s < 2; s++) {
+      geom::Line line = analyser.lines[s][analyser.lines[s].size() / 2];
+      analyser.lines[s].assign(1, line);
+    }
+    analyser.board_size = 1;
+    std::vector<geom::Line> single[2] = { analyser.lines[0], 
+					  analyser.lines[1] };
+    analyser.tune_grid();
+    for (int s = 0; s < 2; s++)
+      test::check(same_lines(analyser.lines[s], single[s]),
+		  "%s: tune_grid() changed a grid of one line", argv[i]);
+    strength = analyser.track(img);
+    test::check(strength == 0, "%s: tracking one line gave strength %g",
+		argv[i], strength);
+    for (int s = 0; s < 2; s++)
+      test::check(same_lines(analyser.lines[s], single[s]),
+		  "%s: track() changed a grid of one line", argv[i]);
+  }
+  return test::finish("test_track");
+}
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <vector>
+#include "../kernel_hough/types.h"
 
 /** Common utility functions. */
 namespace util {
@@ -14,6 +15,17 @@ namespace util {
     return a * a;
   }
 
+  /** Median of the values in a vector, reordering the vector.
+   * \note For odd number (2n + 1) of values, the n'th value is returned.
+   */
+  template <typename T>
+  T
+  median_in_place(std::vector<T> &v)
+  {
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+  }
+
   /** Median of the values in a vector. 
    * \note For odd number (2n + 1) of values, the n'th value is returned.
    */
@@ -21,8 +33,7 @@ namespace util {
   T
   median(std::vector<T> v)
   {
-    std::sort(v.begin(), v.end());
-    return v[v.size() / 2];
+    return median_in_place(v);
   }
 
   /** Absolute value. */
@@ -45,6 +56,108 @@ namespace util {
     return a;
   }
 
+  /** Minimum of two values. */
+  template <typename T>
+  T
+  min(const T &a, const T &b)
+  {
+    if (b < a)
+      return b;
+    return a;
+  }
+
+  /** A pool of threads for calling function objects in parallel.
+   *
+   * The threads are created by the first run() that needs them, and
+   * they wait for the next run() until the pool is destroyed, so a
+   * loop that runs in parallel for every image does not create
+   * threads again.  A pool must not be used by two threads at the
+   * same time.  The threads are those of a thread_pool_t of the KHT
+   * library, which passes each call its index here.
+   */
+  class ThreadPool {
+  public:
+
+    /** Create a pool without threads. */
+    ThreadPool() { }
+
+    /** Call a function object in parallel threads.
+     *
+     * Calls \c func(i) for each \c i in [0, \c n), and waits until
+     * all calls have returned.  The call with index 0 is made in the
+     * calling thread, and the other calls are shared by the calling
+     * thread and the threads of the pool.  The pool is grown to \c n
+     * - 1 threads; if a thread can not be created, the calls are
+     * shared by fewer threads.  A single call is made directly.
+     *
+     * \param n = the number of calls
+     * \param func = the function object to call
+     */
+    template <typename F>
+    void run(int n, F &func)
+    {
+      if (n <= 1) {
+	if (n == 1)
+	  func(0);
+	return;
+      }
+      calls.resize(n);
+      for (int i = 0; i < n; i++) {
+	calls[i].call = call_function<F>;
+	calls[i].func = &func;
+	calls[i].index = i;
+      }
+      pool.run(run_call, &calls[0], sizeof(Call), n);
+    }
+
+  private:
+
+    /** The arguments of one call of run(). */
+    struct Call {
+      void (*call)(void *, int); //!< Calls \ref func
+      void *func; //!< The function object of the run()
+      int index; //!< The index of the call
+    };
+
+    /** Call a function object of type \c F. */
+    template <typename F>
+    static void call_function(void *func, int index)
+    {
+      (*static_cast<F*>(func))(index);
+    }
+
+    /** Make a call of run() in a thread of the pool. */
+    static void *run_call(void *arg)
+    {
+      Call &call = *static_cast<Call*>(arg);
+      call.call(call.func, call.index);
+      return NULL;
+    }
+
+    ThreadPool(const ThreadPool &); //!< Not implemented
+    ThreadPool &operator=(const ThreadPool &); //!< Not implemented
+
+    thread_pool_t pool; //!< The threads
+    std::vector<Call> calls; //!< The calls of the current run()
+  };
+
+  /** Call a function object in parallel threads.
+   *
+   * Calls \c func(i) for each \c i in [0, \c n) as
+   * ThreadPool::run() does, with threads that are created for this
+   * call only.  Use a ThreadPool to keep the threads over calls.
+   *
+   * \param n = the number of calls
+   * \param func = the function object to call
+   */
+  template <typename F>
+  void
+  parallel_for(int n, F &func)
+  {
+    ThreadPool pool;
+    pool.run(n, func);
+  }
+
 };
 
 #endif /* UTIL_HH */
@@ -91,3 +91,27 @@ realloc_2d(void *memblock, const size_t size1, const size_t size2, const size_t
 
 	return memblock;
 }
+
+// Allocates a memory block aligned to 'buffer_alignment' bytes.
+void*
+malloc_aligned(const size_t size)
+{
+	void *memblock = 0;
+
+	if (posix_memalign( &memblock, buffer_alignment, size ) != 0)
+	{
+		return 0;
+	}
+
+	return memblock;
+}
+
+// Returns the number of items of a row of a flat 2D buffer with aligned rows.
+size_t
+aligned_stride(const size_t size2, const size_t data_size)
+{
+	const size_t row_size = size2 * data_size;
+	const size_t aligned_row_size = ((row_size + buffer_alignment - 1) / buffer_alignment) * buffer_alignment;
+
+	return aligned_row_size / data_size;
+}
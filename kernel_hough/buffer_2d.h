@@ -45,4 +45,14 @@ void* memset_2d(void *dest, const int c, const size_t size1, const size_t size2,
 // Reallocate 2D memory blocks.
 void* realloc_2d(void *memblock, const size_t size1, const size_t size2, const size_t data_size);
 
+// The alignment of the rows of flat 2D buffers (in bytes).
+const size_t buffer_alignment = 64;
+
+// Allocates a memory block aligned to 'buffer_alignment' bytes. The block is released with free().
+void* malloc_aligned(const size_t size);
+
+// Returns the number of items of a row of a flat 2D buffer, so that each row of 'size2' items starts at a multiple of
+// 'buffer_alignment' bytes.
+size_t aligned_stride(const size_t size2, const size_t data_size);
+
 #endif // !_BUFFER_2D_
@@ -41,9 +41,18 @@
 void
 kht(lines_list_t &lines, unsigned char *binary_image, const size_t image_width, const size_t image_height, const size_t cluster_min_size, const double cluster_min_deviation, const double delta, const double kernel_min_height, const double n_sigmas)
 {
-	static strings_list_t strings;
-	static clusters_list_t clusters;
-	static accumulator_t accumulator;
+	static kht_context_t context;
+
+	kht( context, lines, binary_image, image_width, image_height, cluster_min_size, cluster_min_deviation, delta, kernel_min_height, n_sigmas );
+}
+
+// Kernel-based Hough transform (KHT) using the buffers of a given context.
+void
+kht(kht_context_t &context, lines_list_t &lines, unsigned char *binary_image, const size_t image_width, const size_t image_height, const size_t cluster_min_size, const double cluster_min_deviation, const double delta, const double kernel_min_height, const double n_sigmas)
+{
+	strings_list_t &strings = context.strings;
+	clusters_list_t &clusters = context.clusters;
+	accumulator_t &accumulator = context.accumulator;
 
 	// Group feature pixels from an input binary into clusters of approximately collinear pixels.
 	find_strings( strings, binary_image, image_width, image_height, cluster_min_size );
@@ -51,8 +60,15 @@ kht(lines_list_t &lines, unsigned char *binary_image, const size_t image_width,
 
 	// Perform the proposed Hough transform voting scheme.
 	accumulator.init( image_width, image_height, delta );
-	voting( accumulator, clusters, kernel_min_height, n_sigmas );
+	voting( accumulator, context.thread_accumulators, context.threads, context.kernels, context.used_kernels, clusters, kernel_min_height, n_sigmas, context.n_threads, context.incremental_votes );
 
 	// Retrieve the most significant straight lines from the resulting voting map.
-	peak_detection( lines, accumulator );
+	if ((context.max_lines != 0) || (context.min_votes_fraction > 0.0))
+	{
+		peak_detection( lines, context.used_bins, context.convolutions, accumulator, context.max_lines, context.min_votes_fraction );
+	}
+	else
+	{
+		peak_detection( lines, context.used_bins, context.visited, accumulator );
+	}
 }
@@ -36,6 +36,98 @@
 
 #include "types.h"
 
+// The buffers of the KHT procedure.
+//
+// A context owns every buffer used by kht(), so that threads running kht() with
+// different contexts do not share any state. The buffers grow to the sizes needed
+// and are kept, so reusing a context for images of the same size does not allocate
+// memory after the first call. A context cannot be copied.
+class kht_context_t
+{
+public:
+
+	// The strings of adjacent feature pixels.
+	strings_list_t strings;
+
+	// The clusters of approximately collinear feature pixels.
+	clusters_list_t clusters;
+
+	// The voting map.
+	accumulator_t accumulator;
+
+	// The Gaussian kernels of the clusters.
+	kernels_list_t kernels;
+
+	// The kernels that pass the culling operation.
+	pkernels_list_t used_kernels;
+
+	// The accumulator bins that receive at least one vote, or the peaks of the accumulator
+	// when the number of lines is limited.
+	bins_list_t used_bins;
+
+	// The bins visited by the peak detection.
+	visited_map_t visited;
+
+	// The convolved votes of three rows of the accumulator, used when the number of lines is limited.
+	convolutions_list_t convolutions;
+
+	// The accumulators of the additional voting threads.
+	accumulators_list_t thread_accumulators;
+
+	// The voting threads, kept between calls.
+	thread_pool_t threads;
+
+	// The number of threads used for voting. The default value is 1. The detected lines
+	// do not depend on the number of threads.
+	size_t n_threads;
+
+	// Evaluate the Gaussian kernels incrementally along the rho coordinates instead of
+	// calling exp() for each bin of the accumulator. The rounding errors may change a vote
+	// whose exact value is very close to a half, so a bin may differ by one. The default
+	// value is false.
+	bool incremental_votes;
+
+	// The maximum number of detected lines, or 0 for no limit. With a limit, only the
+	// peaks of the accumulator are sorted, instead of every bin that receives a vote.
+	// The lines are the first ones found without a limit, because both ways sort the bins
+	// with the same votes in the order of the accumulator rows. The default value is 0.
+	size_t max_lines;
+
+	// Discard the lines whose convolved votes are less than this fraction of the votes
+	// of the strongest line. Like 'max_lines', a fraction greater than 0 sorts only the
+	// peaks of the accumulator. The default value is 0.
+	double min_votes_fraction;
+
+	// Class constructor.
+	kht_context_t() :
+		n_threads(1),
+		incremental_votes(false),
+		max_lines(0),
+		min_votes_fraction(0.0)
+	{
+	}
+
+	// Class destructor.
+	~kht_context_t()
+	{
+		// The lists do not destroy their items, so free the pixels of the strings. The unused
+		// items up to the capacity are zeroed, and may hold pixels of earlier calls.
+		string_t *items = strings.items();
+		for (size_t i=0, end=strings.capacity(); i!=end; ++i)
+		{
+			free( items[i].items() );
+		}
+	}
+
+private:
+
+	// Not implemented.
+	kht_context_t(const kht_context_t&);
+
+	// Not implemented.
+	kht_context_t& operator = (const kht_context_t&);
+};
+
 /* Kernel-based Hough transform (KHT) for detecting straight lines in images.
  *
  * This function performs the KHT procedure over a given binary image and returns a
@@ -81,7 +173,19 @@
  *
  * It is important to notice that the linking procedure implemented by the kht()
  * function destroys the original image.
+ *
+ * This function keeps its buffers in a static context, so it must not be called
+ * from several threads at once. Use the overload below with a context per thread.
  */
 void kht(lines_list_t &lines, unsigned char *binary_image, const size_t image_width, const size_t image_height, const size_t cluster_min_size = 10, const double cluster_min_deviation = 2.0, const double delta = 0.5, const double kernel_min_height = 0.002, const double n_sigmas = 2.0);
 
+/* Kernel-based Hough transform (KHT) using the buffers of a given context.
+ *
+ * This function is the same as the one above, but all buffers are kept in 'context'
+ * instead of static variables. Thus, the function can run in several threads at
+ * once, as long as each thread uses its own context. The detected lines are the same
+ * as with the function above.
+ */
+void kht(kht_context_t &context, lines_list_t &lines, unsigned char *binary_image, const size_t image_width, const size_t image_height, const size_t cluster_min_size = 10, const double cluster_min_deviation = 2.0, const double delta = 0.5, const double kernel_min_height = 0.002, const double n_sigmas = 2.0);
+
 #endif // !_KHT_
@@ -31,103 +31,39 @@
  * along with this program. If not, see http://www.gnu.org/licenses/.
  */
 
+#include <algorithm>
 #include "buffer_2d.h"
 #include "peak_detection.h"
 
-// The coordinates of a bin of the accumulator.
-struct bin_t
+// Orders the bins in descending order of votes, and the bins with the same votes in the order of the accumulator rows.
+struct compare_peaks_t
 {
-	size_t rho_index;   // [1,rho_size] range.
-	size_t theta_index; // [1,theta_size] range.
-
-	int votes;
-};
-
-// Specifies a list of accumulator bins.
-typedef list<bin_t,1000> bins_list_t;
-
-// An auxiliar data structure that identifies which accumulator bin was visited by the peak detection procedure.
-class visited_map_t
-{
-private:
-
-	// The map of flags ([1,theta_size][1,rho_size] range).
-	bool **m_map;
-
-	// Specifies the size of allocated storage for the map (rho dimention).
-	size_t m_rho_capacity;
-
-	// Specifies the size of allocated storage for the map (theta dimention).
-	size_t m_theta_capacity;
-
-public:
-
-	// Initializes the map.
 	inline
-	void init(const size_t accumulator_width, const size_t accumulator_height)
+	bool operator () (const bin_t &bin1, const bin_t &bin2) const
 	{
-		if ((m_rho_capacity < (accumulator_width + 2)) || (m_theta_capacity < (accumulator_height + 2)))
+		if (bin1.votes != bin2.votes)
 		{
-			m_rho_capacity = accumulator_width + 2;
-			m_theta_capacity = accumulator_height + 2;
-
-			m_map = static_cast<bool**>( realloc_2d( m_map, m_theta_capacity, m_rho_capacity, sizeof( bool ) ) );
+			return bin1.votes > bin2.votes;
 		}
-
-		memset_2d( m_map, 0, m_theta_capacity, m_rho_capacity, sizeof( bool ) );
-	}
-	
-	// Sets a given accumulator bin as visited.
-	inline
-	void set_visited(const size_t rho_index, size_t theta_index)
-	{
-		m_map[theta_index][rho_index] = true;
-	}
-
-	// Class constructor.
-	visited_map_t() :
-		m_map(0),
-		m_rho_capacity(0),
-		m_theta_capacity(0)
-	{
-	}
-
-	// Class destructor()
-	~visited_map_t()
-	{
-		free( m_map );
-	}
-
-	// Returns whether a neighbour bin was visited already.
-	inline
-	bool visited_neighbour(const size_t rho_index, const size_t theta_index) const
-	{
-		return m_map[theta_index-1][rho_index-1] || m_map[theta_index-1][rho_index  ] || m_map[theta_index-1][rho_index+1] ||
-			   m_map[theta_index  ][rho_index-1] ||                                      m_map[theta_index  ][rho_index+1] ||
-			   m_map[theta_index+1][rho_index-1] || m_map[theta_index+1][rho_index  ] || m_map[theta_index+1][rho_index+1];
+		return (bin1.theta_index != bin2.theta_index) ? (bin1.theta_index < bin2.theta_index) : (bin1.rho_index < bin2.rho_index);
 	}
 };
 
-inline
-int
-compare_bins(const bin_t *bin1, const bin_t *bin2)
-{
-	return (bin1->votes < bin2->votes) ? 1 : ((bin1->votes > bin2->votes) ? -1 : 0);
-}
-
 // Computes the convolution of the given cell with a (discrete) 3x3 Gaussian kernel.
 inline
 int
-convolution(const int **bins, const int rho_index, const int theta_index)
+convolution(const int *cell, const size_t stride)
 {
-	return bins[theta_index-1][rho_index-1] + bins[theta_index-1][rho_index+1] + bins[theta_index+1][rho_index-1] + bins[theta_index+1][rho_index+1] +
-	       bins[theta_index-1][rho_index  ] + bins[theta_index-1][rho_index  ] + bins[theta_index  ][rho_index-1] + bins[theta_index  ][rho_index-1] + bins[theta_index  ][rho_index+1] + bins[theta_index  ][rho_index+1] + bins[theta_index+1][rho_index  ] + bins[theta_index+1][rho_index  ] +
-	       bins[theta_index  ][rho_index  ] + bins[theta_index  ][rho_index  ] + bins[theta_index  ][rho_index  ] + bins[theta_index  ][rho_index  ];
+	const int *above = cell - stride, *below = cell + stride;
+
+	return above[-1] + above[1] + below[-1] + below[1] +
+	       above[0] + above[0] + cell[-1] + cell[-1] + cell[1] + cell[1] + below[0] + below[0] +
+	       cell[0] + cell[0] + cell[0] + cell[0];
 }
 
 // Identify the peaks of votes (most significant straight lines) in the accmulator.
 void
-peak_detection(lines_list_t &lines, const accumulator_t &accumulator)
+peak_detection(lines_list_t &lines, bins_list_t &used_bins, visited_map_t &visited, const accumulator_t &accumulator)
 {
 	/* Leandro A. F. Fernandes, Manuel M. Oliveira
 	 * Real-time line detection through an improved Hough transform voting scheme
@@ -136,48 +72,48 @@ peak_detection(lines_list_t &lines, const accumulator_t &accumulator)
 	 * Section 3.4
 	 */
 
-	const int **bins = accumulator.bins();
+	const int *bins = accumulator.bins();
+	const size_t stride = accumulator.stride();
 	const double *rho = accumulator.rho();
 	const double *theta = accumulator.theta();
 
 	// Create a list with all cells that receive at least one vote.
-	static bins_list_t used_bins;
-	
 	size_t used_bins_count = 0;
 	for (size_t theta_index=1, theta_end=accumulator.height()+1; theta_index!=theta_end; ++theta_index)
 	{
+		const int *row = bins + (theta_index * stride);
+
 		for (size_t rho_index=1, rho_end=accumulator.width()+1; rho_index!=rho_end; ++rho_index)
 		{
-			if (bins[theta_index][rho_index])
-			{
-				used_bins_count++;
-			}
+			used_bins_count += (row[rho_index] != 0);
 		}
 	}
 	used_bins.resize( used_bins_count );
 		
 	for (size_t theta_index=1, i=0, theta_end=accumulator.height()+1; theta_index!=theta_end; ++theta_index)
 	{
+		const int *row = bins + (theta_index * stride);
+
 		for (size_t rho_index=1, rho_end=accumulator.width()+1; rho_index!=rho_end; ++rho_index)
 		{
-			if (bins[theta_index][rho_index])
+			if (row[rho_index])
 			{
 				bin_t &bin = used_bins[i];
 
 				bin.rho_index = rho_index;
 				bin.theta_index = theta_index;
-				bin.votes = convolution( bins, rho_index, theta_index ); // Convolution of the cells with a 3x3 Gaussian kernel
+				bin.votes = convolution( &row[rho_index], stride ); // Convolution of the cells with a 3x3 Gaussian kernel
 
 				i++;
 			}
 		}
 	}
 	
-	// Sort the list in descending order according to the result of the convolution.
-	std::qsort( used_bins.items(), used_bins_count, sizeof( bin_t ), (int(*)(const void*, const void*))compare_bins );
+	// Sort the list in descending order according to the result of the convolution. The bins with the same convolution
+	// are kept in the order of the rows, so that the lines do not depend on the sorting algorithm.
+	std::sort( used_bins.items(), used_bins.items() + used_bins_count, compare_peaks_t() );
 	
 	// Use a sweep plane that visits each cell of the list.
-	static visited_map_t visited;
 	visited.init( accumulator.width(), accumulator.height() );
 
 	lines.clear();
@@ -197,3 +133,120 @@ peak_detection(lines_list_t &lines, const accumulator_t &accumulator)
 		visited.set_visited( bin.rho_index, bin.theta_index );
 	}
 }
+
+// Computes the convolution of the cells of a row of the accumulator that receive at least one vote. The other cells are set to zero.
+static void
+convolution_row(int *dest, const int *row, const size_t stride, const size_t rho_size)
+{
+	dest[0] = 0;
+	for (size_t rho_index=1, rho_end=rho_size+1; rho_index!=rho_end; ++rho_index)
+	{
+		dest[rho_index] = row[rho_index] ? convolution( &row[rho_index], stride ) : 0;
+	}
+	dest[rho_size+1] = 0;
+}
+
+// Identify at most 'max_lines' peaks of votes whose convolved votes are at least 'min_votes_fraction' of the strongest peak.
+void
+peak_detection(lines_list_t &lines, bins_list_t &peaks, convolutions_list_t &convolutions, const accumulator_t &accumulator, const size_t max_lines, const double min_votes_fraction)
+{
+	// The sweep plane of the function above keeps a cell if none of its neighbours comes first in the sorted list. Thus, the
+	// peaks are found with a single pass over the accumulator, comparing the convolution of each cell with its neighbours,
+	// and only the peaks are sorted.
+
+	const int *bins = accumulator.bins();
+	const size_t stride = accumulator.stride();
+	const size_t rho_size = accumulator.width(), theta_size = accumulator.height();
+	const double *rho = accumulator.rho();
+	const double *theta = accumulator.theta();
+
+	// The convolutions of the previous, current and next rows of the accumulator.
+	convolutions.resize( 3 * stride );
+
+	int *previous = convolutions.items(), *current = previous + stride, *next = current + stride;
+
+	memset( previous, 0, stride * sizeof( int ) );
+	convolution_row( current, bins + stride, stride, rho_size );
+
+	// Find the cells whose convolution is greater than the ones of the neighbours that come first in the order of the rows,
+	// and not less than the ones of the other neighbours.
+	int max_votes = 0;
+
+	peaks.clear();
+
+	for (size_t theta_index=1, theta_end=theta_size+1; theta_index!=theta_end; ++theta_index)
+	{
+		if (theta_index != theta_size)
+		{
+			convolution_row( next, bins + ((theta_index + 1) * stride), stride, rho_size );
+		}
+		else
+		{
+			memset( next, 0, stride * sizeof( int ) );
+		}
+
+		for (size_t rho_index=1, rho_end=rho_size+1; rho_index!=rho_end; ++rho_index)
+		{
+			const int votes = current[rho_index];
+
+			if ((votes != 0) &&
+				(votes > previous[rho_index-1]) && (votes > previous[rho_index]) && (votes > previous[rho_index+1]) && (votes > current[rho_index-1]) &&
+				(votes >= current[rho_index+1]) && (votes >= next[rho_index-1]) && (votes >= next[rho_index]) && (votes >= next[rho_index+1]))
+			{
+				bin_t &bin = peaks.push_back();
+
+				bin.rho_index = rho_index;
+				bin.theta_index = theta_index;
+				bin.votes = votes;
+
+				if (max_votes < votes)
+				{
+					max_votes = votes;
+				}
+			}
+		}
+
+		int *first = previous;
+		previous = current;
+		current = next;
+		next = first;
+	}
+
+	// Discard the peaks below the given fraction of the strongest one.
+	size_t peaks_count = peaks.size();
+
+	if (min_votes_fraction > 0.0)
+	{
+		const double min_votes = min_votes_fraction * max_votes;
+
+		peaks_count = 0;
+		for (size_t i=0, end=peaks.size(); i!=end; ++i)
+		{
+			if (peaks[i].votes >= min_votes)
+			{
+				peaks[peaks_count++] = peaks[i];
+			}
+		}
+	}
+
+	// Select the strongest peaks and sort them in descending order according to the result of the convolution.
+	bin_t *first = peaks.items(), *last = first + peaks_count;
+
+	if ((max_lines != 0) && (peaks_count > max_lines))
+	{
+		std::nth_element( first, first + max_lines, last, compare_peaks_t() );
+		last = first + max_lines;
+	}
+	std::sort( first, last, compare_peaks_t() );
+
+	lines.clear();
+	lines.reserve( last - first );
+
+	for (const bin_t *bin=first; bin!=last; ++bin)
+	{
+		line_t &line = lines.push_back();
+
+		line.rho = rho[bin->rho_index];
+		line.theta = theta[bin->theta_index];
+	}
+}
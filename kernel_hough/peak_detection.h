@@ -36,7 +36,14 @@
 
 #include "types.h"
 
-// Identify the peaks of votes (most significant straight lines) in the accmulator.
-void peak_detection(lines_list_t &lines, const accumulator_t &accumulator);
+// Identify the peaks of votes (most significant straight lines) in the accmulator. The lines are sorted in descending order of
+// convolved votes, and the ones with the same votes in the order of the accumulator rows. The 'used_bins' list and the 'visited'
+// map are work buffers.
+void peak_detection(lines_list_t &lines, bins_list_t &used_bins, visited_map_t &visited, const accumulator_t &accumulator);
+
+// Identify at most 'max_lines' peaks of votes (no limit if 0) whose convolved votes are at least 'min_votes_fraction' of the
+// strongest peak. The lines are the first ones returned by the function above, but only the peaks are sorted. The 'peaks' and
+// 'convolutions' lists are work buffers.
+void peak_detection(lines_list_t &lines, bins_list_t &peaks, convolutions_list_t &convolutions, const accumulator_t &accumulator, const size_t max_lines, const double min_votes_fraction);
 
 #endif // !_PEAK_DETECTION_
@@ -37,6 +37,7 @@
 #include <cmath>
 #include <cstdlib>
 #include <memory.h>
+#include <pthread.h>
 #include "buffer_2d.h"
 
 // A simple accumulator class implementation.
@@ -59,8 +60,12 @@ public:
 
 private:
 
-	// Accumulator bins ([1,height][1,width] range).
-	int **m_bins;
+	// Accumulator bins ([1,height][1,width] range), stored in rows of 'm_stride' items. The rows and columns 0 and
+	// height+1 or width+1 are padding.
+	int *m_bins;
+
+	// Specifies the size of allocated storage for the bins.
+	size_t m_bins_capacity;
 
 	// Discretization step.
 	double m_delta;
@@ -92,6 +97,9 @@ private:
 	// Specifies the size of allocated storage for the accumulator (theta dimention).
 	size_t m_theta_capacity;
 
+	// The distance between the rows of the bins (a multiple of 'buffer_alignment' bytes).
+	size_t m_stride;
+
 	// Accumulator width (rho dimention).
 	size_t m_width;
 
@@ -100,6 +108,7 @@ public:
 	// Class constructor.
 	accumulator_t() :
 		m_bins(0),
+		m_bins_capacity(0),
 		m_delta(0),
 		m_height(0),
 		m_image_height(0),
@@ -110,6 +119,7 @@ public:
 		m_theta(0),
 		m_theta_bounds(0,0),
 		m_theta_capacity(0),
+		m_stride(0),
 		m_width(0)
 	{
 	}
@@ -117,6 +127,7 @@ public:
 	// Class constructor.
 	accumulator_t(const size_t image_width, const size_t image_height, const double delta) :
 		m_bins(0),
+		m_bins_capacity(0),
 		m_delta(0),
 		m_height(0),
 		m_image_height(0),
@@ -127,6 +138,7 @@ public:
 		m_theta(0),
 		m_theta_bounds(0,0),
 		m_theta_capacity(0),
+		m_stride(0),
 		m_width(0)
 	{
 		init( image_width, image_height, delta );
@@ -140,25 +152,26 @@ public:
 		free( m_theta );
 	}
 
-	// Returns the accumulator bins ([1,height][1,width] range).
+	// Returns the accumulator bins ([1,height][1,width] range). The bin [theta_index][rho_index] is at
+	// bins()[theta_index * stride() + rho_index].
 	inline
-	int** bins()
+	int* bins()
 	{
 		return m_bins;
 	}
 
 	// Returns the accumulator bins ([1,height][1,width] range).
 	inline
-	const int** bins() const
+	const int* bins() const
 	{
-		return const_cast<const int**>( m_bins );
+		return m_bins;
 	}
 
 	// Set zeros to the accumulator bins.
 	inline
 	void clear()
 	{
-		memset_2d( m_bins, 0, m_height + 2, m_width + 2, sizeof( int ) );
+		memset( m_bins, 0, (m_height + 2) * m_stride * sizeof( int ) );
 	}
 
 	// Returns the discretization step.
@@ -236,7 +249,13 @@ public:
 			m_theta_bounds.upper = 180.0 - delta;
 
 			// Accumulator bins.
-			m_bins = static_cast<int**>( realloc_2d( m_bins, m_height + 2, m_width + 2, sizeof( int ) ) );
+			m_stride = aligned_stride( m_width + 2, sizeof( int ) );
+
+			if (m_bins_capacity < ((m_height + 2) * m_stride))
+			{
+				free( m_bins );
+				m_bins = static_cast<int*>( malloc_aligned( (m_bins_capacity = ((m_height + 2) * m_stride)) * sizeof( int ) ) );
+			}
 		}
 
 		clear();
@@ -270,6 +289,13 @@ public:
 		return m_theta_bounds;
 	}
 
+	// Returns the distance between the rows of the bins.
+	inline
+	size_t stride() const
+	{
+		return m_stride;
+	}
+
 	// Returns the accumulator width (rho dimention).
 	inline
 	size_t width() const
@@ -278,6 +304,238 @@ public:
 	}
 };
 
+// A list of accumulators that keeps the allocated accumulators when resized.
+class accumulators_list_t
+{
+private:
+
+	// Specifies the size of allocated storage for the container.
+	size_t m_capacity;
+
+	// Specifies the list of accumulators.
+	accumulator_t *m_items;
+
+	// Counts the number of elements.
+	size_t m_size;
+
+	// Not implemented.
+	accumulators_list_t(const accumulators_list_t&);
+
+	// Not implemented.
+	accumulators_list_t& operator = (const accumulators_list_t&);
+
+public:
+
+	// Class constructor.
+	accumulators_list_t() :
+		m_capacity(0),
+		m_items(0),
+		m_size(0)
+	{
+	}
+
+	// Class destructor.
+	~accumulators_list_t()
+	{
+		delete [] m_items;
+	}
+
+	// Specifies a new size for a list.
+	inline
+	void resize(const size_t size)
+	{
+		if (m_capacity < size)
+		{
+			delete [] m_items;
+			m_items = new accumulator_t[size];
+			m_capacity = size;
+		}
+		m_size = size;
+	}
+
+	// Returns the number of elements.
+	inline
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	// Returns a reference to the list element at a specified position.
+	inline
+	accumulator_t& operator [] (const size_t index)
+	{
+		return m_items[index];
+	}
+};
+
+// A pool of threads that keeps its threads between parallel runs.
+class thread_pool_t
+{
+private:
+
+	// The threads of the pool.
+	pthread_t *m_threads;
+
+	// Specifies the size of allocated storage for the threads.
+	size_t m_capacity;
+
+	// Counts the number of threads.
+	size_t m_size;
+
+	// Protects the state of the current run.
+	pthread_mutex_t m_mutex;
+
+	// Signalled when a run starts, and when the pool is destroyed.
+	pthread_cond_t m_work;
+
+	// Signalled when the last call of a run returns.
+	pthread_cond_t m_done;
+
+	// The function and the arguments of the current run.
+	void *(*m_func)(void*);
+	char *m_args;
+	size_t m_arg_size;
+
+	// The number of calls of the current run, the next call to make, and the calls still running.
+	size_t m_calls;
+	size_t m_next_call;
+	size_t m_unfinished;
+
+	// Set when the pool is destroyed.
+	bool m_quit;
+
+	// Not implemented.
+	thread_pool_t(const thread_pool_t&);
+
+	// Not implemented.
+	thread_pool_t& operator = (const thread_pool_t&);
+
+	// Makes the calls that are not taken yet. The mutex must be locked.
+	inline
+	void run_calls()
+	{
+		while (m_next_call < m_calls)
+		{
+			void *arg = m_args + (m_next_call++ * m_arg_size);
+
+			pthread_mutex_unlock( &m_mutex );
+			m_func( arg );
+			pthread_mutex_lock( &m_mutex );
+
+			if (--m_unfinished == 0)
+			{
+				pthread_cond_signal( &m_done );
+			}
+		}
+	}
+
+	// The start routine of the threads.
+	static
+	void* thread_main(void *arg)
+	{
+		thread_pool_t &pool = *static_cast<thread_pool_t*>( arg );
+
+		pthread_mutex_lock( &pool.m_mutex );
+		while (true)
+		{
+			pool.run_calls();
+			if (pool.m_quit)
+			{
+				break;
+			}
+			pthread_cond_wait( &pool.m_work, &pool.m_mutex );
+		}
+		pthread_mutex_unlock( &pool.m_mutex );
+
+		return 0;
+	}
+
+public:
+
+	// Class constructor.
+	thread_pool_t() :
+		m_threads(0),
+		m_capacity(0),
+		m_size(0),
+		m_func(0),
+		m_args(0),
+		m_arg_size(0),
+		m_calls(0),
+		m_next_call(0),
+		m_unfinished(0),
+		m_quit(false)
+	{
+		pthread_mutex_init( &m_mutex, 0 );
+		pthread_cond_init( &m_work, 0 );
+		pthread_cond_init( &m_done, 0 );
+	}
+
+	// Class destructor.
+	~thread_pool_t()
+	{
+		pthread_mutex_lock( &m_mutex );
+		m_quit = true;
+		pthread_cond_broadcast( &m_work );
+		pthread_mutex_unlock( &m_mutex );
+
+		for (size_t i=0; i!=m_size; ++i)
+		{
+			pthread_join( m_threads[i], 0 );
+		}
+		free( m_threads );
+
+		pthread_cond_destroy( &m_done );
+		pthread_cond_destroy( &m_work );
+		pthread_mutex_destroy( &m_mutex );
+	}
+
+	// Calls 'func' for each of the 'n' arguments stored at 'args' with 'arg_size' bytes each, and waits until all calls
+	// have returned. The first call is made in the calling thread. The pool is grown to n-1 threads, and if a thread
+	// cannot be created, the calls are shared by fewer threads.
+	inline
+	void run(void *(*func)(void*), void *args, const size_t arg_size, const size_t n)
+	{
+		if (n == 0)
+		{
+			return;
+		}
+
+		if (m_capacity < (n - 1))
+		{
+			m_threads = static_cast<pthread_t*>( realloc( m_threads, (m_capacity = (n - 1)) * sizeof( pthread_t ) ) );
+		}
+		while ((m_size < (n - 1)) && (pthread_create( &m_threads[m_size], 0, thread_main, this ) == 0))
+		{
+			m_size++;
+		}
+
+		pthread_mutex_lock( &m_mutex );
+		m_func = func;
+		m_args = static_cast<char*>( args );
+		m_arg_size = arg_size;
+		m_calls = n;
+		m_next_call = 1;
+		m_unfinished = n - 1;
+		if (m_unfinished != 0)
+		{
+			pthread_cond_broadcast( &m_work );
+		}
+		pthread_mutex_unlock( &m_mutex );
+
+		func( args );
+
+		pthread_mutex_lock( &m_mutex );
+		run_calls();
+		while (m_unfinished != 0)
+		{
+			pthread_cond_wait( &m_done, &m_mutex );
+		}
+		m_calls = 0;
+		m_next_call = 0;
+		pthread_mutex_unlock( &m_mutex );
+	}
+};
+
 // A simple list implementation (use it only with aggregate types).
 template<typename item_type, size_t capacity_inc>
 class list
@@ -302,6 +560,13 @@ public:
 		m_size = 0;
 	}
 
+	// Returns the size of allocated storage for the container.
+	inline
+	size_t capacity() const
+	{
+		return m_capacity;
+	}
+
 	// Tests if the list is empty.
 	inline
 	bool empty() const
@@ -454,4 +719,113 @@ typedef list<pixel_t,500> string_t;
 // Specifies a list of string of feature pixels.
 typedef list<string_t,1000> strings_list_t;
 
+// An elliptical-Gaussian kernel.
+struct kernel_t
+{
+	const cluster_t *pcluster;
+
+	double rho;
+	double theta;
+
+	matrix_t lambda;    // [sigma^2_rho sigma_rhotheta; sigma_rhotheta sigma^2_theta]
+
+	size_t rho_index;	// [1,rho_size] range
+	size_t theta_index; // [1,theta_size] range
+
+	double height;
+};
+
+// Specifies a list of Gaussian kernels.
+typedef list<kernel_t,1000> kernels_list_t;
+
+// Specifies a list of pointers to Gaussian kernels.
+typedef list<kernel_t*,1000> pkernels_list_t;
+
+// The coordinates of a bin of the accumulator.
+struct bin_t
+{
+	size_t rho_index;   // [1,rho_size] range.
+	size_t theta_index; // [1,theta_size] range.
+
+	int votes;
+};
+
+// Specifies a list of accumulator bins.
+typedef list<bin_t,1000> bins_list_t;
+
+// Specifies a list of convolved votes.
+typedef list<int,1000> convolutions_list_t;
+
+// An auxiliar data structure that identifies which accumulator bin was visited by the peak detection procedure.
+class visited_map_t
+{
+private:
+
+	// The map of flags ([1,theta_size][1,rho_size] range), stored in rows of 'm_stride' items like the bins of the
+	// accumulator.
+	bool *m_map;
+
+	// Specifies the size of allocated storage for the map.
+	size_t m_capacity;
+
+	// The number of rows of the map.
+	size_t m_rows;
+
+	// The distance between the rows of the map.
+	size_t m_stride;
+
+public:
+
+	// Initializes the map.
+	inline
+	void init(const size_t accumulator_width, const size_t accumulator_height)
+	{
+		m_rows = accumulator_height + 2;
+		m_stride = aligned_stride( accumulator_width + 2, sizeof( bool ) );
+
+		if (m_capacity < (m_rows * m_stride))
+		{
+			free( m_map );
+			m_map = static_cast<bool*>( malloc_aligned( (m_capacity = (m_rows * m_stride)) * sizeof( bool ) ) );
+		}
+
+		memset( m_map, 0, m_rows * m_stride * sizeof( bool ) );
+	}
+	
+	// Sets a given accumulator bin as visited.
+	inline
+	void set_visited(const size_t rho_index, size_t theta_index)
+	{
+		m_map[(theta_index * m_stride) + rho_index] = true;
+	}
+
+	// Class constructor.
+	visited_map_t() :
+		m_map(0),
+		m_capacity(0),
+		m_rows(0),
+		m_stride(0)
+	{
+	}
+
+	// Class destructor()
+	~visited_map_t()
+	{
+		free( m_map );
+	}
+
+	// Returns whether a neighbour bin was visited already.
+	inline
+	bool visited_neighbour(const size_t rho_index, const size_t theta_index) const
+	{
+		const bool *above = &m_map[((theta_index - 1) * m_stride) + rho_index];
+		const bool *center = above + m_stride;
+		const bool *below = center + m_stride;
+
+		return above[-1] || above[0] || above[1] ||
+			   center[-1] ||            center[1] ||
+			   below[-1] || below[0] || below[1];
+	}
+};
+
 #endif // !_TYPES_
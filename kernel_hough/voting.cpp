@@ -31,6 +31,7 @@
  * along with this program. If not, see http://www.gnu.org/licenses/.
  */
 
+#include <algorithm>
 #include <limits>
 #include "voting.h"
 #include "eigen.h"
@@ -38,28 +39,6 @@
 // pi value.
 static const double pi = 3.14159265358979323846;
 
-// An elliptical-Gaussian kernel.
-struct kernel_t
-{
-	const cluster_t *pcluster;
-
-	double rho;
-	double theta;
-
-	matrix_t lambda;    // [sigma^2_rho sigma_rhotheta; sigma_rhotheta sigma^2_theta]
-
-	size_t rho_index;	// [1,rho_size] range
-	size_t theta_index; // [1,theta_size] range
-
-	double height;
-};
-
-// Specifies a list of Gaussian kernels.
-typedef list<kernel_t,1000> kernels_list_t;
-
-// Specifies a list of pointers to Gaussian kernels.
-typedef list<kernel_t*,1000> pkernels_list_t;
-
 // Bi-variated Gaussian distribution.
 inline
 double
@@ -121,9 +100,15 @@ solve(matrix_t &result, const matrix_t &nabla, const matrix_t &lambda)
 }
 
 // This function complements the proposed voting process.
+//
+// With 'incremental' set, the Gaussian is evaluated with exp() only once for each call. The exponent is quadratic
+// in rho, so the ratio between the values at successive rho coordinates is itself multiplied by a constant factor at
+// each step, and a run of rho coordinates costs two multiplications per bin. The same holds for the values and the
+// ratios at the start of the runs along the theta coordinates. The rounding errors of the products may change a
+// vote by one where the exact value is very close to a half.
 inline
 void
-vote(accumulator_t &accumulator, size_t rho_start_index, const size_t theta_start_index, const double rho_start, const double theta_start, int inc_rho_index, const int inc_theta_index, const double sigma2_rho, const double sigma2_theta, const double sigma_rho_theta, const double scale)
+vote(accumulator_t &accumulator, size_t rho_start_index, const size_t theta_start_index, const double rho_start, const double theta_start, int inc_rho_index, const int inc_theta_index, const double sigma2_rho, const double sigma2_theta, const double sigma_rho_theta, const double scale, const bool incremental)
 {
 	/* Leandro A. F. Fernandes, Manuel M. Oliveira
 	 * Real-time line detection through an improved Hough transform voting scheme
@@ -132,8 +117,9 @@ vote(accumulator_t &accumulator, size_t rho_start_index, const size_t theta_star
 	 * Algorithm 4
 	 */
 
-	int **bins = accumulator.bins();
+	int *bins = accumulator.bins(), *row;
 	
+	const size_t stride = accumulator.stride();
 	const size_t rho_size = accumulator.width(), theta_size = accumulator.height();
 	const double delta = accumulator.delta();
 	const double inc_rho = delta * inc_rho_index, inc_theta = delta * inc_theta_index;
@@ -147,6 +133,21 @@ vote(accumulator_t &accumulator, size_t rho_start_index, const size_t theta_star
 	double rho, theta;
 	int votes, theta_not_voted = 0;
 	size_t rho_index, theta_index, theta_count = 0;
+
+	// The value at the start of the current run, the ratio between the values at successive rho coordinates, and
+	// the factors that update them from one step to the next.
+	double value = 0.0, ratio = 0.0, start_value = 0.0, start_step = 0.0, start_ratio = 0.0;
+	double ratio_step = 0.0, start_step_step = 0.0, start_ratio_step = 0.0;
+
+	if (incremental)
+	{
+		start_value = gauss( rho_start, theta_start, sigma2_rho, sigma2_theta, sigma_rho_sigma_theta, two_r, a, b ) * scale;
+		start_step = exp( -b * ((((2.0 * theta_start * inc_theta) + (inc_theta * inc_theta)) / sigma2_theta) - ((two_r * rho_start * inc_theta) / sigma_rho_sigma_theta)) );
+		start_step_step = exp( -b * ((2.0 * inc_theta * inc_theta) / sigma2_theta) );
+		start_ratio = exp( -b * ((((2.0 * rho_start * inc_rho) + (inc_rho * inc_rho)) / sigma2_rho) - ((two_r * inc_rho * theta_start) / sigma_rho_sigma_theta)) );
+		start_ratio_step = exp( b * ((two_r * inc_rho * inc_theta) / sigma_rho_sigma_theta) );
+		ratio_step = exp( -b * ((2.0 * inc_rho * inc_rho) / sigma2_rho) );
+	}
 	
 	// Loop for the theta coordinates of the parameter space.
 	theta_index = theta_start_index;
@@ -163,16 +164,38 @@ vote(accumulator_t &accumulator, size_t rho_start_index, const size_t theta_star
 
 		// Loop for the rho coordinates of the parameter space.
 		theta_voted = false;
+		row = bins + (theta_index * stride);
 
 		rho_index = rho_start_index;
 		rho = rho_start;
-		while (((votes = static_cast<int>( (gauss( rho, theta, sigma2_rho, sigma2_theta, sigma_rho_sigma_theta, two_r, a, b ) * scale) + 0.5 )) > 0) && (rho_index >= 1) && (rho_index <= rho_size))
+		if (incremental)
+		{
+			value = start_value;
+			ratio = start_ratio;
+			while (((votes = static_cast<int>( value + 0.5 )) > 0) && (rho_index >= 1) && (rho_index <= rho_size))
+			{
+				row[rho_index] += votes;
+				theta_voted = true;
+
+				rho_index += inc_rho_index;
+				value *= ratio;
+				ratio *= ratio_step;
+			}
+
+			start_value *= start_step;
+			start_step *= start_step_step;
+			start_ratio *= start_ratio_step;
+		}
+		else
 		{
-			bins[theta_index][rho_index] += votes;
-			theta_voted = true;
+			while (((votes = static_cast<int>( (gauss( rho, theta, sigma2_rho, sigma2_theta, sigma_rho_sigma_theta, two_r, a, b ) * scale) + 0.5 )) > 0) && (rho_index >= 1) && (rho_index <= rho_size))
+			{
+				row[rho_index] += votes;
+				theta_voted = true;
 
-			rho_index += inc_rho_index;
-			rho += inc_rho;
+				rho_index += inc_rho_index;
+				rho += inc_rho;
+			}
 		}
 
 		if (!theta_voted)
@@ -187,119 +210,273 @@ vote(accumulator_t &accumulator, size_t rho_start_index, const size_t theta_star
 	while ((theta_not_voted != 2) && (theta_count < theta_size));
 }
 
-// Performs the proposed Hough transform voting scheme.
+// Fits the elliptical-Gaussian kernel of a cluster (Algorithm 2).
+inline
 void
-voting(accumulator_t &accumulator, const clusters_list_t &clusters, const double kernel_min_height, const double n_sigmas)
+fit_kernel(kernel_t &kernel, const cluster_t &cluster, const double one_div_delta, const double n_sigmas2, const double rho_max)
 {
-	/* Leandro A. F. Fernandes, Manuel M. Oliveira
-	 * Real-time line detection through an improved Hough transform voting scheme
-	 * Pattern Recognition (PR), Elsevier, 41:1, 2008, 299-314.
-	 *
-	 * Algorithm 2
-	 */
-	static kernels_list_t kernels;
-	static pkernels_list_t used_kernels;
-
-	kernels.resize( clusters.size() );
-	used_kernels.resize( clusters.size() );
-
 	matrix_t M, V, S;
 	point_t mean, u, v;
 	double x, y, Sxx, Syy, Sxy, aux;
 
 	static const double rad_to_deg = 180.0 / pi;
+
+	kernel.pcluster = &cluster;
+	
+	// Alternative reference system definition.
+	mean.x = mean.y = 0.0;
+	for (size_t i=0; i!=cluster.size; ++i)
+	{
+		mean.x += cluster.pixels[i].x;
+		mean.y += cluster.pixels[i].y;
+	}
+	mean.x /= cluster.size;
+	mean.y /= cluster.size;
+	
+	Sxx = Syy = Sxy = 0.0;
+	for (size_t i=0; i!=cluster.size; ++i)
+	{
+		x = cluster.pixels[i].x - mean.x;
+		y = cluster.pixels[i].y - mean.y;
+	
+		Sxx += (x * x);
+		Syy += (y * y);
+		Sxy += (x * y);
+	}
+	
+	M[0] = Sxx;
+	M[3] = Syy;
+	M[1] = M[2] = Sxy;
+	eigen( V, S, M );
+
+	u.x = V[0];
+	u.y = V[2];
+	
+	v.x = V[1];
+	v.y = V[3];
+	
+	// y_v >= 0 condition verification.
+	if (v.y < 0.0)
+	{
+		v.x *= -1.0;
+		v.y *= -1.0;
+	}
+
+	// Normal equation parameters computation (Eq. 3).
+	kernel.rho = (v.x * mean.x) + (v.y * mean.y);
+	kernel.theta = acos( v.x ) * rad_to_deg;
+
+	kernel.rho_index = static_cast<size_t>( std::abs( (kernel.rho + rho_max) * one_div_delta ) ) + 1;
+	kernel.theta_index = static_cast<size_t>( std::abs( kernel.theta * one_div_delta ) ) + 1;
+
+	// sigma^2_m' and sigma^2_b' computation, substituting Eq. 5 in Eq. 10.
+	aux = sqrt( 1.0 - (v.x * v.x) );
+	matrix_t nabla = {
+			             -((u.x * mean.x) + (u.y * mean.y)), 1.0,
+			(aux != 0.0) ? ((u.x / aux) * rad_to_deg) : 0.0, 0.0
+		};
+
+	aux = 0.0;
+	for (size_t i=0; i!=cluster.size; ++i)
+	{
+		x = (u.x * (cluster.pixels[i].x - mean.x)) + (u.y * (cluster.pixels[i].y - mean.y));
+		aux += (x * x);
+	}
+
+	matrix_t lambda = {
+			1.0 / aux,                0.0,
+				  0.0, 1.0 / cluster.size
+		};
+
+	// Uncertainty from sigma^2_m' and sigma^2_b' to sigma^2_rho,  sigma^2_theta and sigma_rho_theta.
+	solve( kernel.lambda, nabla, lambda );
+
+	if (kernel.lambda[3] == 0.0)
+	{
+		kernel.lambda[3] = 0.1;
+	}
+
+	kernel.lambda[0] *= n_sigmas2;
+	kernel.lambda[3] *= n_sigmas2;
+
+	// Compute the height of the kernel.
+	kernel.height = gauss( 0.0, 0.0, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1] );
+}
+
+// Returns the scale factor that makes the votes of a kernel at the g_min threshold equal to one.
+inline
+double
+kernel_scale(const kernel_t &kernel)
+{
+	matrix_t V, S;
+
+	eigen( V, S, kernel.lambda );
+	double radius = sqrt( S[3] );
+
+	double scale = gauss( V[1] * radius, V[3] * radius, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1] );
+	return (scale < 1.0) ? (1.0 / scale) : 1.0;
+}
+
+// Votes for a kernel in the four quadrants around its center.
+inline
+void
+vote_kernel(accumulator_t &accumulator, const kernel_t &kernel, const double kernels_scale, const bool incremental)
+{
 	const double delta = accumulator.delta();
-	const double one_div_delta = 1.0 / delta;
-	const double n_sigmas2 = n_sigmas * n_sigmas;
-	const double rho_max = accumulator.rho_bounds().upper;
 
-	for (size_t k=0, end=clusters.size(); k!=end; ++k)
+	vote( accumulator, kernel.rho_index,     kernel.theta_index,        0.0,    0.0,  1,  1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale, incremental );
+	vote( accumulator, kernel.rho_index,     kernel.theta_index - 1,    0.0, -delta,  1, -1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale, incremental );
+	vote( accumulator, kernel.rho_index - 1, kernel.theta_index,     -delta,    0.0, -1,  1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale, incremental );
+	vote( accumulator, kernel.rho_index - 1, kernel.theta_index - 1, -delta, -delta, -1, -1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale, incremental );
+}
+
+// The work of one thread of the parallel voting.
+struct voting_task_t
+{
+	// The range of kernels (or accumulator rows while merging) of the thread.
+	size_t first;
+	size_t last;
+
+	// The accumulator voted by the thread.
+	accumulator_t *accumulator;
+
+	// The accumulators of the other threads (merging only).
+	accumulators_list_t *accumulators;
+
+	const clusters_list_t *clusters;
+	kernels_list_t *kernels;
+	const pkernels_list_t *used_kernels;
+
+	double one_div_delta;
+	double n_sigmas2;
+	double rho_max;
+
+	// The largest scale factor of the range, or the scale factor used for voting.
+	double kernels_scale;
+
+	// Evaluate the Gaussian incrementally along the rho coordinates.
+	bool incremental;
+};
+
+// Fits the kernels of a range of clusters.
+static void*
+fit_kernels_task(void *arg)
+{
+	voting_task_t &task = *static_cast<voting_task_t*>( arg );
+
+	for (size_t k=task.first; k!=task.last; ++k)
 	{
-		const cluster_t &cluster = clusters[k];
-		kernel_t &kernel = kernels[k];
+		fit_kernel( (*task.kernels)[k], (*task.clusters)[k], task.one_div_delta, task.n_sigmas2, task.rho_max );
+	}
+	return 0;
+}
 
-		kernel.pcluster = &cluster;
-		
-		// Alternative reference system definition.
-		mean.x = mean.y = 0.0;
-		for (size_t i=0; i!=cluster.size; ++i)
-		{
-			mean.x += cluster.pixels[i].x;
-			mean.y += cluster.pixels[i].y;
-		}
-		mean.x /= cluster.size;
-		mean.y /= cluster.size;
-		
-		Sxx = Syy = Sxy = 0.0;
-		for (size_t i=0; i!=cluster.size; ++i)
-		{
-			x = cluster.pixels[i].x - mean.x;
-			y = cluster.pixels[i].y - mean.y;
-		
-			Sxx += (x * x);
-			Syy += (y * y);
-			Sxy += (x * y);
-		}
-		
-		M[0] = Sxx;
-		M[3] = Syy;
-		M[1] = M[2] = Sxy;
-		eigen( V, S, M );
+// Finds the largest scale factor of a range of used kernels.
+static void*
+scale_kernels_task(void *arg)
+{
+	voting_task_t &task = *static_cast<voting_task_t*>( arg );
 
-		u.x = V[0];
-		u.y = V[2];
-		
-		v.x = V[1];
-		v.y = V[3];
-		
-		// y_v >= 0 condition verification.
-		if (v.y < 0.0)
+	task.kernels_scale = std::numeric_limits<double>::min();
+	for (size_t k=task.first; k!=task.last; ++k)
+	{
+		double scale = kernel_scale( *(*task.used_kernels)[k] );
+
+		if (task.kernels_scale < scale)
 		{
-			v.x *= -1.0;
-			v.y *= -1.0;
+			task.kernels_scale = scale;
 		}
+	}
+	return 0;
+}
 
-		// Normal equation parameters computation (Eq. 3).
-		kernel.rho = (v.x * mean.x) + (v.y * mean.y);
-		kernel.theta = acos( v.x ) * rad_to_deg;
+// Votes for a range of used kernels.
+static void*
+vote_kernels_task(void *arg)
+{
+	voting_task_t &task = *static_cast<voting_task_t*>( arg );
 
-		kernel.rho_index = static_cast<size_t>( std::abs( (kernel.rho + rho_max) * one_div_delta ) ) + 1;
-		kernel.theta_index = static_cast<size_t>( std::abs( kernel.theta * one_div_delta ) ) + 1;
+	for (size_t k=task.first; k!=task.last; ++k)
+	{
+		vote_kernel( *task.accumulator, *(*task.used_kernels)[k], task.kernels_scale, task.incremental );
+	}
+	return 0;
+}
 
-		// sigma^2_m' and sigma^2_b' computation, substituting Eq. 5 in Eq. 10.
-		aux = sqrt( 1.0 - (v.x * v.x) );
-		matrix_t nabla = {
-				             -((u.x * mean.x) + (u.y * mean.y)), 1.0,
-				(aux != 0.0) ? ((u.x / aux) * rad_to_deg) : 0.0, 0.0
-			};
+// Adds the bins of the other accumulators to a range of rows of the accumulator.
+static void*
+merge_accumulators_task(void *arg)
+{
+	voting_task_t &task = *static_cast<voting_task_t*>( arg );
 
-		aux = 0.0;
-		for (size_t i=0; i!=cluster.size; ++i)
-		{
-			x = (u.x * (cluster.pixels[i].x - mean.x)) + (u.y * (cluster.pixels[i].y - mean.y));
-			aux += (x * x);
-		}
+	// The rows are contiguous and all accumulators share the same stride, so the range is added as a single block.
+	const size_t stride = task.accumulator->stride();
+	const size_t first = task.first * stride, count = (task.last - task.first) * stride;
 
-		matrix_t lambda = {
-				1.0 / aux,                0.0,
-					  0.0, 1.0 / cluster.size
-			};
+	int *bins = task.accumulator->bins() + first;
 
-		// Uncertainty from sigma^2_m' and sigma^2_b' to sigma^2_rho,  sigma^2_theta and sigma_rho_theta.
-		solve( kernel.lambda, nabla, lambda );
+	for (size_t i=0, end=task.accumulators->size(); i!=end; ++i)
+	{
+		const int *other = (*task.accumulators)[i].bins() + first;
 
-		if (kernel.lambda[3] == 0.0)
+		for (size_t j=0; j!=count; ++j)
 		{
-			kernel.lambda[3] = 0.1;
+			bins[j] += other[j];
 		}
+	}
+	return 0;
+}
+
+// Splits 'count' items into contiguous ranges and runs 'func' for each range in the threads of the pool, the first
+// range in the calling thread.
+static void
+run_tasks(thread_pool_t &threads, void *(*func)(void*), voting_task_t *tasks, const size_t n_tasks, const size_t count)
+{
+	for (size_t t=0; t!=n_tasks; ++t)
+	{
+		tasks[t].first = (count * t) / n_tasks;
+		tasks[t].last = (count * (t + 1)) / n_tasks;
+	}
+
+	threads.run( func, tasks, sizeof( voting_task_t ), n_tasks );
+}
+
+// Performs the proposed Hough transform voting scheme.
+void
+voting(accumulator_t &accumulator, accumulators_list_t &thread_accumulators, thread_pool_t &threads, kernels_list_t &kernels, pkernels_list_t &used_kernels, const clusters_list_t &clusters, const double kernel_min_height, const double n_sigmas, const size_t n_threads, const bool incremental_votes)
+{
+	/* Leandro A. F. Fernandes, Manuel M. Oliveira
+	 * Real-time line detection through an improved Hough transform voting scheme
+	 * Pattern Recognition (PR), Elsevier, 41:1, 2008, 299-314.
+	 *
+	 * Algorithm 2
+	 */
+	kernels.resize( clusters.size() );
+	used_kernels.resize( clusters.size() );
+
+	const double delta = accumulator.delta();
 
-		kernel.lambda[0] *= n_sigmas2;
-		kernel.lambda[3] *= n_sigmas2;
+	voting_task_t tasks[max_voting_threads];
+	const size_t n_tasks = std::max( static_cast<size_t>( 1 ), std::min( n_threads, max_voting_threads ) );
 
-		// Compute the height of the kernel.
-		kernel.height = gauss( 0.0, 0.0, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1] );
+	for (size_t t=0; t!=n_tasks; ++t)
+	{
+		voting_task_t &task = tasks[t];
+
+		task.accumulator = &accumulator;
+		task.accumulators = &thread_accumulators;
+		task.clusters = &clusters;
+		task.kernels = &kernels;
+		task.used_kernels = &used_kernels;
+		task.one_div_delta = 1.0 / delta;
+		task.n_sigmas2 = n_sigmas * n_sigmas;
+		task.rho_max = accumulator.rho_bounds().upper;
+		task.incremental = incremental_votes;
 	}
 
+	// The kernels are independent of each other.
+	run_tasks( threads, fit_kernels_task, tasks, std::min( n_tasks, std::max( clusters.size(), static_cast<size_t>( 1 ) ) ), clusters.size() );
+
 	/* Leandro A. F. Fernandes, Manuel M. Oliveira
 	 * Real-time line detection through an improved Hough transform voting scheme
 	 * Pattern Recognition (PR), Elsevier, 41:1, 2008, 299-314.
@@ -338,34 +515,50 @@ voting(accumulator_t &accumulator, const clusters_list_t &clusters, const double
 	}
 	used_kernels.resize( i );
 
-	// Find the g_min threshold and compute the scale factor for integer votes.
-	double radius, scale;
+	// Find the g_min threshold and compute the scale factor for integer votes. The maximum does not depend on the order of the kernels.
+	const size_t n_voting_tasks = std::min( n_tasks, std::max( used_kernels.size(), static_cast<size_t>( 1 ) ) );
 	double kernels_scale = std::numeric_limits<double>::min();
 
-	for (size_t k=0, end=used_kernels.size(); k!=end; ++k)
+	run_tasks( threads, scale_kernels_task, tasks, n_voting_tasks, used_kernels.size() );
+	for (size_t t=0; t!=n_voting_tasks; ++t)
 	{
-		kernel_t &kernel = *used_kernels[k];
-
-		eigen( V, S, kernel.lambda );
-		radius = sqrt( S[3] );
-
-		scale = gauss( V[1] * radius, V[3] * radius, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1] );
-		scale = (scale < 1.0) ? (1.0 / scale) : 1.0;
-
-		if (kernels_scale < scale)
+		if (kernels_scale < tasks[t].kernels_scale)
 		{
-			kernels_scale = scale;
+			kernels_scale = tasks[t].kernels_scale;
 		}
 	}
 
-	// Vote for each selected kernel.
-	for (size_t k=0, end=used_kernels.size(); k!=end; ++k)
+	// Vote for each selected kernel. With several threads, each thread votes into its own accumulator, and the
+	// accumulators are summed by rows. The votes are integers, so the sums are the same as voting serially.
+	if (n_voting_tasks > 1)
 	{
-		kernel_t &kernel = *used_kernels[k];
+		thread_accumulators.resize( n_voting_tasks - 1 );
+	}
+	else
+	{
+		thread_accumulators.resize( 0 );
+	}
+	
+	for (size_t t=0; t!=n_voting_tasks; ++t)
+	{
+		if (t > 0)
+		{
+			accumulator_t &other = thread_accumulators[t-1];
+			
+			other.init( accumulator.image_width(), accumulator.image_height(), delta );
+			tasks[t].accumulator = &other;
+		}
+		tasks[t].kernels_scale = kernels_scale;
+	}
 
-		vote( accumulator, kernel.rho_index,     kernel.theta_index,        0.0,    0.0,  1,  1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale );
-		vote( accumulator, kernel.rho_index,     kernel.theta_index - 1,    0.0, -delta,  1, -1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale );
-		vote( accumulator, kernel.rho_index - 1, kernel.theta_index,     -delta,    0.0, -1,  1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale );
-		vote( accumulator, kernel.rho_index - 1, kernel.theta_index - 1, -delta, -delta, -1, -1, kernel.lambda[0], kernel.lambda[3], kernel.lambda[1], kernels_scale );
+	run_tasks( threads, vote_kernels_task, tasks, n_voting_tasks, used_kernels.size() );
+
+	if (n_voting_tasks > 1)
+	{
+		for (size_t t=0; t!=n_voting_tasks; ++t)
+		{
+			tasks[t].accumulator = &accumulator;
+		}
+		run_tasks( threads, merge_accumulators_task, tasks, std::min( n_voting_tasks, accumulator.height() + 2 ), accumulator.height() + 2 );
 	}
 }
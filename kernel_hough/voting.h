@@ -36,7 +36,13 @@
 
 #include "types.h"
 
-// Performs the proposed Hough transform voting scheme.
-void voting(accumulator_t &accumulator, const clusters_list_t &clusters, const double kernel_min_height, const double n_sigmas);
+// The maximum number of threads used by voting().
+const size_t max_voting_threads = 64;
+
+// Performs the proposed Hough transform voting scheme. The 'thread_accumulators', 'kernels' and 'used_kernels' lists
+// are work buffers. With 'n_threads' greater than one, the kernels are fitted and voted in the threads of 'threads',
+// and the resulting bins are the same as with one thread. With 'incremental_votes', the Gaussian kernels are evaluated
+// incrementally along the rho coordinates instead of calling exp() for each bin, and a bin may differ by one.
+void voting(accumulator_t &accumulator, accumulators_list_t &thread_accumulators, thread_pool_t &threads, kernels_list_t &kernels, pkernels_list_t &used_kernels, const clusters_list_t &clusters, const double kernel_min_height, const double n_sigmas, const size_t n_threads = 1, const bool incremental_votes = false);
 
 #endif // !_VOTING_